@@ -1,8 +1,9 @@
 #include "../include/DataIO.h"
-#include "../include/WaveformProcessor.h"
-#include "../include/EventAnalyzer.h"
+#include "../include/RunAnalyzer.h"
 #include "../include/Config.h"
 #include "../include/Ntupler.h"
+#include "../include/Provenance.h"
+#include "../include/AnalysisSetup.h"
 
 #include <iostream>
 #include <string>
@@ -11,8 +12,6 @@
 #include <fstream>
 #include <sstream>
 #include <memory>
-#include "TH1F.h"
-#include "TH2F.h"
 #include "TString.h"
 #include "TFile.h"
 #include "TSystem.h"
@@ -23,17 +22,29 @@ using namespace HRPPD;
 // Default configuration file path
 const std::string DEFAULT_CONFIG_FILE = "../config/config.txt";
 
+// "0,5,10" for the log
+std::string JoinChannels(const std::vector<int>& channels) {
+    std::string list;
+    for (size_t i = 0; i < channels.size(); i++) {
+        list += (i > 0 ? "," : "") + std::to_string(channels[i]);
+    }
+    return list;
+}
+
 // Common IO setup function
-bool Init(DataIO& dataIO, const int runNumber, const int channelNumber, 
-             const std::string& outputSuffix, std::string& outputFileName) {
+bool Init(DataIO& dataIO, const int runNumber, const std::vector<int>& channels, 
+             const std::string& outputSuffix, std::string& outputFileName,
+             const CommandLineOptions& options) {
 
-    outputFileName = Form("%s/run%d/%s_Run_%d.root", 
-                         CONFIG_OUTPUT_PATH.c_str(), runNumber, outputSuffix.c_str(), runNumber);
+    outputFileName = GetRunFile(outputSuffix, runNumber);
 
     dataIO.SetPath(CONFIG_OUTPUT_PATH); 
+    dataIO.SetNtuplePath(CONFIG_NTUPLE_PATH);
+    dataIO.SetRawDataPath(CONFIG_RAWDATA_PATH);
+    dataIO.SetSource(options.source == "raw" ? DataIO::Source::kRaw : DataIO::Source::kNtuple);
     
-    if (!dataIO.Load(runNumber, channelNumber, true)) {
-        std::cerr << "Failed to open file: Run " << runNumber << ", Channel " << channelNumber << std::endl;
+    if (!dataIO.Load(runNumber, channels, true)) {
+        std::cerr << "Failed to open file: Run " << runNumber << ", Channels " << JoinChannels(channels) << std::endl;
         return false;
     }
     
@@ -48,187 +59,67 @@ bool Init(DataIO& dataIO, const int runNumber, const int channelNumber,
 }
 
 
-void analyzer(const int runNumber, const int channelNumber = 10, const int maxEvents = -1, 
-              const std::string& configFile = DEFAULT_CONFIG_FILE, bool processAll = true,
-              bool doWaveform = false, bool doWaveform2D = false, bool doToT = false,
-              bool doTiming = false, bool doAmplitude = false, bool doNpe = false) {
+void analyzer(const int runNumber, const std::vector<int>& channels = {10}, const int maxEvents = -1, 
+              const std::string& configFile = DEFAULT_CONFIG_FILE, const std::string& analysisType = "all",
+              const CommandLineOptions& options = CommandLineOptions()) {
 
     DataIO dataIO;
-    WaveformProcessor processor;
-    EventAnalyzer analyzer;
     
     if (!Load(configFile)) {
         std::cerr << "Failed to load config file, proceeding with default values." << std::endl;
     }
     
-    // Set parameters
-    processor.fCalibrationConstant = CONFIG_CALIBRATION_CONSTANT;
-    processor.fDeltaT = CONFIG_DELTA_T;
-    processor.fSamplingRate = CONFIG_SAMPLING_RATE;
-    analyzer.fTriggerCfdFraction = CONFIG_TRIGGER_CFD_FRACTION;
-    analyzer.fTriggerCfdDelay = CONFIG_TRIGGER_CFD_DELAY;
-    analyzer.fMcpCfdFraction = CONFIG_MCP_CFD_FRACTION;
-    analyzer.fMcpCfdDelay = CONFIG_MCP_CFD_DELAY;
-    analyzer.fTriggerWindowMin = CONFIG_TRIGGER_WINDOW_MIN;
-    analyzer.fTriggerWindowMax = CONFIG_TRIGGER_WINDOW_MAX;
-    analyzer.fMcpWindowMin = CONFIG_MCP_WINDOW_MIN;
-    analyzer.fMcpWindowMax = CONFIG_MCP_WINDOW_MAX;
-    analyzer.fFftCutoffFrequency = CONFIG_FFT_CUTOFF_FREQUENCY;
-    analyzer.fApplyFFTFilter = CONFIG_APPLY_FFT_FILTER;
-
-    if (processAll) {
-        doWaveform = doWaveform2D = doToT = doTiming = doAmplitude = doNpe = true;
-    } else {
-        if (!doWaveform && !doWaveform2D && !doToT && !doTiming && !doAmplitude && !doNpe) {
-            doWaveform = CONFIG_DO_WAVEFORM;
-            doWaveform2D = CONFIG_DO_WAVEFORM2D;
-            doToT = CONFIG_DO_TOT;
-            doTiming = CONFIG_DO_TIMING;
-            doAmplitude = CONFIG_DO_AMPLITUDE;
-            doNpe = CONFIG_DO_NPE;
-        }
-    }
+    AnalysisOptions analysis = MakeAnalysisOptions(analysisType, runNumber, options);
     
     gSystem->mkdir(CONFIG_OUTPUT_PATH.c_str(), true);
     gSystem->mkdir(Form("%s/run%d", CONFIG_OUTPUT_PATH.c_str(), runNumber), true);
     
-    std::cout << "=== Starting analysis for Run " << runNumber << ", Ch " << channelNumber << " ===" << std::endl;
-    
-    std::string outputFileName;
-    if (!Init(dataIO, runNumber, channelNumber, "Analysis", outputFileName)) {
-        std::cerr << "IO setup failed. Aborting analysis." << std::endl;
+    if (options.rehistogram) {
+        // Histograms from the feature tree of an earlier pass, written next to its Analysis file
+        std::string outputFileName = GetRunFile("Rehist", runNumber);
+        std::cout << "=== Rebuilding histograms for Run " << runNumber << ", Ch " << JoinChannels(channels) << " ===" << std::endl;
+        if (!dataIO.SetFile(outputFileName)) {
+            std::cerr << "Failed to create output file: " << outputFileName << std::endl;
+            return;
+        }
+        analysis.doWaveform = analysis.doWaveform2D = false;
+        RunAnalyzer runAnalyzer(analysis);
+        bool ok = runAnalyzer.Rehistogram(dataIO, channels, GetRunFile("Features", runNumber));
+        dataIO.Close();
+        if (!ok) {
+            std::cerr << "Rebuilding the histograms of Run " << runNumber << " failed." << std::endl;
+            return;
+        }
+        std::cout << "Results saved to: " << outputFileName << std::endl;
         return;
-    }   
-    
-    if (doWaveform) {
-        dataIO.SetDir("Waveforms_Trig");
-        dataIO.SetDir("Waveforms_MCP");
-        // dataIO.SetDir("Waveforms_MCP_filtered");
-        dataIO.SetDir("CFD_Trig");
-        dataIO.SetDir("CFD_MCP");
     }
     
-    // Declare histograms using raw pointers
-    TH2F* hTrig2D = nullptr;
-    TH2F* hMCP2D = nullptr;
-    if (doWaveform2D) {
-        hTrig2D = new TH2F("Waveform_2D_Trig", "Trigger Waveforms 2D;Time [ns];Amplitude [mV]", 1000, 0., 200., 4000, -1000., 1000.);
-        hMCP2D = new TH2F("Waveform_2D_MCP", "MCP Waveforms 2D;Time [ns];Amplitude [mV]", 1000, 0., 200., 4000, -1000., 1000.);
-    }
-
-    TH2F* hToT = nullptr;
-    if (doToT) {
-        hToT = new TH2F("ToT", "ToT;Amplitude [mV];Time [ps]", 100, 0., 60., 40, 0., 8000.);
+    // An output made from the same inputs, configuration and library is kept
+    if (!options.force && IsUpToDate(runNumber, channels, maxEvents, analysis, options.source)) {
+        return;
     }
     
-    // Timing histograms
-    TH1F* hTrigTiming = nullptr;
-    TH1F* hMCPTiming = nullptr;
-    TH1F* hDiffTiming = nullptr;
-    if (doTiming) {
-        hTrigTiming = new TH1F("Timing_Trig", "Trigger Timing;Time [ps];Counts", 1000, 0., 120000.);
-        hMCPTiming = new TH1F("Timing_MCP", "MCP Timing;Time [ps];Counts", 1000, 20000., 240000.);
-        hDiffTiming = new TH1F("Timing_Diff", "Timing Resolution;Time [ps];Counts", 1000, 50000., 80000.);
-    }
+    std::cout << "=== Starting analysis for Run " << runNumber << ", Ch " << JoinChannels(channels) << " ===" << std::endl;
     
-    // Amplitude histogram
-    TH1F* hAmp = nullptr;
-    if (doAmplitude) {
-        hAmp = new TH1F("Amplitude", "MCP Amplitude;Amplitude [mV];Counts", 1000, 0., 100.);
-    }
+    std::string outputFileName;
+    if (!Init(dataIO, runNumber, channels, "Analysis", outputFileName, options)) {
+        std::cerr << "IO setup failed. Aborting analysis." << std::endl;
+        return;
+    }   
     
-    // Npe histogram
-    TH1F* hNpe = nullptr;
-    if (doNpe) {    
-        hNpe = new TH1F("Npe", "Number of Photoelectrons;Npe;Counts", 1000, 0., 15000000.);
+    // Event loop over all channels (serial or on options.threads worker threads, same output either way)
+    RunAnalyzer runAnalyzer(analysis);
+    if (!runAnalyzer.Run(dataIO, runNumber, maxEvents)) {
+        std::cerr << "Analysis of Run " << runNumber << " failed." << std::endl;
+        dataIO.Close();
+        return;
     }
     
-    analyzer.Init();
-    
-
-    // Event loop
-    int totalEvents = dataIO.GetEntries();
-    int processEvents = (maxEvents < 0) ? totalEvents : std::min(maxEvents, totalEvents);
-    
-    std::cout << "Processing " << processEvents << " events..." << std::endl;
-    
-    for (int evt = 0; evt < processEvents; evt++) {
-        if (!dataIO.GetEvent(evt)) continue;
-        if (evt % 1000 == 0) std::cout << "Processing event " << evt << "/" << processEvents << "..." << std::endl;
-
-        std::vector<float> trigWave = dataIO.GetWaveform("trigger");
-        std::vector<float> mcpWave = dataIO.GetWaveform("mcp");
-        
-        // Correct waveforms
-        std::vector<float> corrTrig = processor.Correct(trigWave);
-        std::vector<float> corrMCP = processor.Correct(mcpWave);
-        
-        // Signal validation
-        float amp = analyzer.GetAmp(corrMCP, analyzer.fMcpWindowMin, analyzer.fMcpWindowMax);
-        float threshold = 4.0 * processor.GetStdDev(corrMCP);
-        bool isSignal = (amp > threshold && processor.ToTCut(corrMCP, analyzer.fMcpWindowMin, analyzer.fMcpWindowMax));
-
-        // Waveform analysis
-        if (doWaveform && isSignal) {
-            // FFT filtering
-            std::vector<float> filtered = processor.FFTFilter(corrMCP, analyzer.fFftCutoffFrequency, evt, channelNumber);
-            
-            TH1F hTrig(Form("Trig_Wave_Evt%d", evt), Form("Trigger Waveform - Run %d, Event %d", runNumber, evt), 1000, 0, 200.);
-            TH1F hMCP(Form("MCP_Wave_Evt%d_Ch%d", evt, channelNumber), Form("MCP Waveform - Run %d, Event %d, Ch %d", runNumber, evt, channelNumber), 1000, 0, 200.); 
-            TH1F hMCP_filt(Form("MCP_Wave_Evt%d_Ch%d_filtered", evt, channelNumber), Form("MCP Waveform (Filtered) - Run %d, Event %d, Ch %d", runNumber, evt, channelNumber), 1000, 0, 200.);
-            
-            // Fill histograms
-            for (int i = 0; i < 1000; i++) {
-                hTrig.SetBinContent(i+1, corrTrig[i]);
-                hMCP.SetBinContent(i+1, corrMCP[i]);
-                hMCP_filt.SetBinContent(i+1, filtered[i]);
-            }
-            
-            hMCP.GetYaxis()->SetRangeUser(-100., 50.);
-            hMCP_filt.GetYaxis()->SetRangeUser(-100., 50.);
-            
-            dataIO.Save(&hTrig, "Waveforms_Trig");
-            dataIO.Save(&hMCP, "Waveforms_MCP");
-            // dataIO.Save(&hMCP_filt, "Waveforms_MCP_filtered");
-        }
-
-        // 2D waveform analysis
-        if (doWaveform2D && isSignal) {
-            for (int i = 0; i < 1000; i++) {
-                double time = i * 0.2;
-                hTrig2D->Fill(time, corrTrig[i]);
-                hMCP2D->Fill(time, corrMCP[i]);
-            }
-        }
-
-        // ToT analysis
-        if (doToT && isSignal) {
-            hToT->Fill(amp, processor.GetToT(corrMCP, analyzer.fMcpWindowMin, analyzer.fMcpWindowMax));
-        }
-        
-        // Timing analysis
-        if (doTiming && isSignal) {
-            float triggerTime = analyzer.GetCFDTime(corrTrig, 0, evt, analyzer.fTriggerWindowMin, analyzer.fTriggerWindowMax, analyzer.fTriggerCfdFraction, analyzer.fTriggerCfdDelay, true, true, "CFD_Trig");
-            float mcpTime = analyzer.GetCFDTime(corrMCP, channelNumber, evt, analyzer.fMcpWindowMin, analyzer.fMcpWindowMax, analyzer.fMcpCfdFraction, analyzer.fMcpCfdDelay, false, true, "CFD_MCP");
-
-            hTrigTiming->Fill(triggerTime);
-            hMCPTiming->Fill(mcpTime);
-            hDiffTiming->Fill(mcpTime - triggerTime);
-        }
-
-        // Amplitude analysis
-        if (doAmplitude && isSignal) {
-            hAmp->Fill(amp);
-        }
-        
-        // Npe analysis
-        if (doNpe && isSignal) {
-            float npe = analyzer.GetNpe(corrMCP, analyzer.fMcpWindowMin, analyzer.fMcpWindowMax);
-            if (npe > threshold) {
-                hNpe->Fill(npe);
-            }
-        }
-    }
+    // Written last, so an interrupted or failed run is analysed again. The ntuple exists now,
+    // so it is described as found after any conversion.
+    Provenance provenance = Provenance::ForRun(runNumber, channels, maxEvents, analysis, options.source);
+    TNamed provenanceObject(kProvenanceName, provenance.GetText().c_str());
+    dataIO.Save(&provenanceObject);
     
     dataIO.Close();
     
@@ -240,36 +131,32 @@ void analyzer(const int runNumber, const int channelNumber = 10, const int maxEv
 int main(int argc, char** argv) {
     // Default values
     int runNumber = 101;
-    int channelNumber = 10;
+    std::vector<int> channels = {10};
     int maxEvents = -1;
     std::string configFile = DEFAULT_CONFIG_FILE;
-    bool processAll = true;
-    bool doWaveform = false;
-    bool doWaveform2D = false;
-    bool doToT = false;
-    bool doTiming = false;
-    bool doAmplitude = false;
-    bool doNpe = false;
-    if (argc > 1) runNumber = atoi(argv[1]);
-    if (argc > 2) channelNumber = atoi(argv[2]);
-    if (argc > 3) maxEvents = atoi(argv[3]);
-    if (argc > 4) configFile = argv[4];
-    if (argc > 5) {
-        std::string mode = argv[5];
-        if (mode == "all") {
-            processAll = true;
-        } else {
-            processAll = false;
-            doWaveform = (mode.find('w') != std::string::npos);
-            doWaveform2D = (mode.find('2') != std::string::npos);
-            doToT = (mode.find('t') != std::string::npos);
-            doTiming = (mode.find('t') != std::string::npos);
-            doAmplitude = (mode.find('a') != std::string::npos);
-            doNpe = (mode.find('n') != std::string::npos);
+    std::string analysisType = "all";
+    CommandLineOptions options;
+    
+    // Split "--name value" options from the positional arguments
+    std::vector<std::string> args;
+    if (!ParseCommandLine(argc, argv, {"--source", "--threads", "--pipeline", "--rehistogram", "--force"}, options, args)) {
+        return 1;
+    }
+    
+    if (args.size() > 0) runNumber = atoi(args[0].c_str());
+    // Channel: a number, a comma separated list ("0,5,10") or "all"
+    if (args.size() > 1) {
+        channels = ParseChannels(args[1]);
+        if (channels.empty()) {
+            std::cerr << "Invalid channel list: " << args[1] << std::endl;
+            return 1;
         }
     }
+    if (args.size() > 2) maxEvents = atoi(args[2].c_str());
+    if (args.size() > 3) configFile = args[3];
+    if (args.size() > 4) analysisType = args[4];
     
-    analyzer(runNumber, channelNumber, maxEvents, configFile, processAll, doWaveform, doWaveform2D, doToT, doTiming, doAmplitude, doNpe);
+    analyzer(runNumber, channels, maxEvents, configFile, analysisType, options);
     
     return 0;
 } 
\ No newline at end of file
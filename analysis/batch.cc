@@ -0,0 +1,335 @@
+#include "../include/DataIO.h"
+#include "../include/RunAnalyzer.h"
+#include "../include/Config.h"
+#include "../include/Ntupler.h"
+#include "../include/Provenance.h"
+#include "../include/WorkStealingPool.h"
+#include "../include/AnalysisSetup.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "TString.h"
+#include "TFile.h"
+#include "TNamed.h"
+#include "TROOT.h"
+#include "TSystem.h"
+
+using namespace HRPPD;
+
+
+// Default configuration file path
+const std::string DEFAULT_CONFIG_FILE = "../config/config.txt";
+
+// Seconds between two progress lines
+const double PROGRESS_INTERVAL = 5.;
+
+// State of one run of the batch. The run task sets it up and submits a task per chunk; the chunk
+// task that writes the last chunk finishes the run and releases its input and output.
+struct BatchRun {
+    enum State { kQueued, kRunning, kDone, kSkipped, kFailed };
+
+    int runNumber = 0;
+    AnalysisOptions analysis;
+    std::atomic<int> state{kQueued};
+
+    std::mutex mutex;                             // Guards the two pointers against the progress report
+    std::unique_ptr<DataIO> dataIO;
+    std::unique_ptr<RunAnalyzer> runAnalyzer;
+    std::atomic<long long> processEvents{0};      // Known once the run has begun
+    std::atomic<int> nextChunk{0};                // First chunk not yet taken by a chunk task
+};
+
+// "123-140", "123,125,130-135" or "123"; empty on a malformed list
+std::vector<int> ParseRuns(const std::string& runList) {
+    std::vector<int> runs;
+    size_t start = 0;
+    while (start <= runList.size()) {
+        size_t end = runList.find(',', start);
+        if (end == std::string::npos) end = runList.size();
+        std::string item = runList.substr(start, end - start);
+        size_t dash = item.find('-', 1);
+        try {
+            size_t pos = 0;
+            int first = std::stoi(item, &pos);
+            int last = first;
+            if (dash != std::string::npos) {
+                if (pos != dash) return {};
+                last = std::stoi(item.substr(dash + 1), &pos);
+                pos += dash + 1;
+            }
+            if (pos != item.size() || last < first) return {};
+            for (int run = first; run <= last; run++) {
+                runs.push_back(run);
+            }
+        } catch (const std::exception&) {
+            return {};
+        }
+        start = end + 1;
+    }
+    return runs;
+}
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Guards the output stage of FinishRun. Finish() draws the CFD canvases, which live in gROOT's global
+// list, sets gStyle and builds the 2D histograms; none of that is thread-safe across runs.
+std::mutex gOutputMutex;
+
+// Write the results of a run whose chunks are all merged, then free it
+void FinishRun(BatchRun& run, const std::vector<int>& channels, int maxEvents, const CommandLineOptions& options) {
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(gOutputMutex);
+        ok = run.runAnalyzer->Finish();
+        if (ok) {
+            // Written last, as in the analyzer, so a failed run is analysed again
+            Provenance provenance = Provenance::ForRun(run.runNumber, channels, maxEvents, run.analysis, options.source);
+            TNamed provenanceObject(kProvenanceName, provenance.GetText().c_str());
+            run.dataIO->Save(&provenanceObject);
+        }
+        run.dataIO->Close();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(run.mutex);
+        run.runAnalyzer.reset();
+        run.dataIO.reset();
+    }
+    if (ok) {
+        std::cout << "=== Analysis for Run " << run.runNumber << " completed ===" << std::endl;
+    } else {
+        std::cerr << "Analysis of Run " << run.runNumber << " failed." << std::endl;
+    }
+    run.state = ok ? BatchRun::kDone : BatchRun::kFailed;
+}
+
+// Run-level task: open the run, split it into chunks and submit a chunk task per worker of the run
+// (analysis.threads). Each task takes the next chunk in entry order until none is left. The tasks
+// go to this thread's deque, so idle threads steal them; the other threads start the next run.
+void StartRun(WorkStealingPool& pool, BatchRun& run, const std::vector<int>& channels, int maxEvents,
+              const CommandLineOptions& options) {
+    std::string outputFileName = GetRunFile("Analysis", run.runNumber);
+    std::cout << "=== Starting analysis for Run " << run.runNumber << " ===" << std::endl;
+
+    auto dataIO = std::make_unique<DataIO>();
+    dataIO->SetPath(CONFIG_OUTPUT_PATH);
+    dataIO->SetNtuplePath(CONFIG_NTUPLE_PATH);
+    dataIO->SetRawDataPath(CONFIG_RAWDATA_PATH);
+    dataIO->SetSource(options.source == "raw" ? DataIO::Source::kRaw : DataIO::Source::kNtuple);
+
+    // Missing ntuples were made before the pool started
+    if (!dataIO->Load(run.runNumber, channels, false)) {
+        std::cerr << "Failed to open file: Run " << run.runNumber << std::endl;
+        run.state = BatchRun::kFailed;
+        return;
+    }
+    if (!dataIO->SetFile(outputFileName)) {
+        std::cerr << "Failed to create output file: " << outputFileName << std::endl;
+        dataIO->Close();
+        run.state = BatchRun::kFailed;
+        return;
+    }
+
+    auto runAnalyzer = std::make_unique<RunAnalyzer>(run.analysis);
+    if (!runAnalyzer->Begin(*dataIO, run.runNumber, maxEvents)) {
+        std::cerr << "Analysis of Run " << run.runNumber << " failed." << std::endl;
+        dataIO->Close();
+        run.state = BatchRun::kFailed;
+        return;
+    }
+    run.processEvents = runAnalyzer->GetProcessEvents();
+    int nChunks = runAnalyzer->GetNChunks();
+    {
+        std::lock_guard<std::mutex> lock(run.mutex);
+        run.dataIO = std::move(dataIO);
+        run.runAnalyzer = std::move(runAnalyzer);
+    }
+
+    if (nChunks == 0) {
+        FinishRun(run, channels, maxEvents, options);
+        return;
+    }
+    int nTasks = std::min(nChunks, std::max(1, run.analysis.threads));
+    for (int task = 0; task < nTasks; task++) {
+        pool.Submit([&run, &channels, maxEvents, &options, nChunks] {
+            for (int chunk = run.nextChunk++; chunk < nChunks; chunk = run.nextChunk++) {
+                if (run.runAnalyzer->ProcessChunk(chunk)) {
+                    FinishRun(run, channels, maxEvents, options);
+                }
+            }
+        });
+    }
+}
+
+// One line for the whole batch: runs finished, entries analysed in the runs begun so far, throughput
+void PrintProgress(std::vector<std::unique_ptr<BatchRun>>& runs, std::chrono::steady_clock::time_point start) {
+    int nFinished = 0, nActive = 0, nTotal = 0;
+    long long analysed = 0, known = 0;
+    for (auto& run : runs) {
+        int state = run->state;
+        if (state == BatchRun::kSkipped) continue;
+        nTotal++;
+        if (state == BatchRun::kDone || state == BatchRun::kFailed) {
+            nFinished++;
+            analysed += run->processEvents;
+            known += run->processEvents;
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(run->mutex);
+        if (run->runAnalyzer) {
+            nActive++;
+            analysed += run->runAnalyzer->GetAnalysedEntries();
+            known += run->processEvents;
+        }
+    }
+    double seconds = Seconds(start);
+    std::cout << Form("[batch] %d/%d runs done, %d running, %lld/%lld entries of the runs begun, %.0f events/s",
+                      nFinished, nTotal, nActive, analysed, known, seconds > 0 ? analysed / seconds : 0.) << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+    // Default values
+    std::vector<int> runNumbers;
+    std::vector<int> channels = {10};
+    int maxEvents = -1;
+    std::string configFile = DEFAULT_CONFIG_FILE;
+    std::string mode = "all";
+    CommandLineOptions options;
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Split "--name value" options from the positional arguments
+    std::vector<std::string> args;
+    if (!ParseCommandLine(argc, argv, {"--source", "--threads", "--run-threads", "--force"}, options, args)) {
+        return 1;
+    }
+
+    if (args.empty()) {
+        std::cerr << "Usage: batch <runs> [channels] [maxEvents] [configFile] [mode] [--threads N] [--run-threads N] [--source ntuple|raw] [--force on|off]" << std::endl
+                  << "  runs: \"123-140\", \"123,125,130-135\" or a single run" << std::endl;
+        return 1;
+    }
+    runNumbers = ParseRuns(args[0]);
+    if (runNumbers.empty()) {
+        std::cerr << "Invalid run list: " << args[0] << std::endl;
+        return 1;
+    }
+    // Channel: a number, a comma separated list ("0,5,10") or "all"
+    if (args.size() > 1) {
+        channels = ParseChannels(args[1]);
+        if (channels.empty()) {
+            std::cerr << "Invalid channel list: " << args[1] << std::endl;
+            return 1;
+        }
+    }
+    if (args.size() > 2) maxEvents = atoi(args[2].c_str());
+    if (args.size() > 3) configFile = args[3];
+    if (args.size() > 4) mode = args[4];
+
+    if (!Load(configFile)) {
+        std::cerr << "Failed to load config file, proceeding with default values." << std::endl;
+    }
+
+    gSystem->mkdir(CONFIG_OUTPUT_PATH.c_str(), true);
+
+    std::vector<std::unique_ptr<BatchRun>> runs;
+    for (int runNumber : runNumbers) {
+        auto run = std::make_unique<BatchRun>();
+        run->runNumber = runNumber;
+        // Same analyses as the analyzer for the same mode argument. Chunks of every run share the
+        // pool; a run uses at most runThreads of its threads.
+        run->analysis = MakeAnalysisOptions(mode, runNumber, options);
+        run->analysis.threads = std::min(options.runThreads, options.threads);
+        run->analysis.printProgress = false;
+        gSystem->mkdir(Form("%s/run%d", CONFIG_OUTPUT_PATH.c_str(), runNumber), true);
+        runs.push_back(std::move(run));
+    }
+
+    std::cout << "=== Batch of " << runs.size() << " run(s) (" << args[0] << ") on " << options.threads
+              << " thread(s) ===" << std::endl;
+
+    // Missing ntuples first, one run at a time: the Ntupler parallelises a conversion itself
+    // through ROOT's implicit MT, which is process wide and must not overlap the pool
+    if (options.source == "ntuple") {
+        for (auto& run : runs) {
+            if (Ntupler::Check(run->runNumber, CONFIG_NTUPLE_PATH)) continue;
+            std::cout << "Ntuplizing Run " << run->runNumber << "..." << std::endl;
+            Ntupler ntupler;
+            if (!ntupler.Convert(run->runNumber, -1)) {
+                std::cerr << "Ntuplizing Run " << run->runNumber << " failed" << std::endl;
+                run->state = BatchRun::kFailed;
+            }
+        }
+    }
+
+    // An output made from the same inputs, configuration and library is kept
+    if (!options.force) {
+        for (auto& run : runs) {
+            if (run->state == BatchRun::kQueued && IsUpToDate(run->runNumber, channels, maxEvents, run->analysis, options.source)) {
+                run->state = BatchRun::kSkipped;
+            }
+        }
+    }
+
+    ROOT::EnableThreadSafety();
+    auto start = std::chrono::steady_clock::now();
+    {
+        WorkStealingPool pool(options.threads);
+        std::vector<BatchRun*> submitted;
+        for (auto& run : runs) {
+            if (run->state != BatchRun::kQueued) continue;
+            BatchRun* batchRun = run.get();
+            submitted.push_back(batchRun);
+            pool.Submit([&pool, batchRun, &channels, maxEvents, &options] {
+                batchRun->state = BatchRun::kRunning;
+                StartRun(pool, *batchRun, channels, maxEvents, options);
+            });
+        }
+
+        // Progress of the whole batch from the main thread until every run is done or failed
+        auto lastReport = std::chrono::steady_clock::now();
+        for (;;) {
+            size_t nFinished = 0;
+            for (BatchRun* run : submitted) {
+                if (run->state == BatchRun::kDone || run->state == BatchRun::kFailed) nFinished++;
+            }
+            if (nFinished == submitted.size()) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (Seconds(lastReport) >= PROGRESS_INTERVAL) {
+                PrintProgress(runs, start);
+                lastReport = std::chrono::steady_clock::now();
+            }
+        }
+        pool.Wait();
+    }
+    double seconds = Seconds(start);
+
+    int nDone = 0, nSkipped = 0;
+    long long nEvents = 0;
+    std::string failed;
+    for (auto& run : runs) {
+        if (run->state == BatchRun::kDone) {
+            nDone++;
+            nEvents += run->processEvents;
+        } else if (run->state == BatchRun::kSkipped) {
+            nSkipped++;
+        } else {
+            failed += (failed.empty() ? "" : ",") + std::to_string(run->runNumber);
+        }
+    }
+    std::cout << "=== Batch completed: " << nDone << " run(s) analysed, " << nSkipped << " up to date, "
+              << (failed.empty() ? "none" : failed) << " failed ===" << std::endl;
+    std::cout << Form("%lld events in %.1f s, %.0f events/s on %d thread(s)",
+                      nEvents, seconds, seconds > 0 ? nEvents / seconds : 0., options.threads) << std::endl;
+
+    return failed.empty() ? 0 : 1;
+}
@@ -0,0 +1,849 @@
+#include "../include/Config.h"
+#include "../include/DataIO.h"
+#include "../include/Ntupler.h"
+#include "../include/RawReader.h"
+#include "../include/WaveformProcessor.h"
+#include "../include/EventAnalyzer.h"
+#include "../include/FFTFilterEngine.h"
+#include "../include/RunAnalyzer.h"
+#include "../include/FeatureTree.h"
+#include "../include/WaveformSnapshot.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <thread>
+#include <cmath>
+#include <sys/stat.h>
+#include "TStopwatch.h"
+#include "TString.h"
+#include "TH1F.h"
+#include "TH1D.h"
+#include "TMath.h"
+#include "TVirtualFFT.h"
+#include "TSpline.h"
+#include "TFile.h"
+#include "TKey.h"
+#include "TParameter.h"
+#include "TSystem.h"
+
+using namespace HRPPD;
+
+
+// Default configuration file path
+const std::string DEFAULT_CONFIG_FILE = "../config/config.txt";
+
+// Raw .dat file names of one run (trigger first)
+std::vector<std::string> GetRawFiles(const int runNumber) {
+    std::string runDir = Ntupler::GetRunDir(runNumber, CONFIG_RAWDATA_PATH);
+    std::vector<std::string> files;
+    files.push_back(runDir + "/TR_0_0.dat");
+    for (int ch = 0; ch < 16; ch++) {
+        files.push_back(runDir + "/wave_" + std::to_string(ch) + ".dat");
+    }
+    return files;
+}
+
+void PrintResult(const std::string& name, double bytes, double seconds, double checksum) {
+    std::cout << "  " << name << ": " << bytes / 1e6 << " MB in " << seconds << " s -> "
+              << (seconds > 0 ? bytes / 1e6 / seconds : 0.) << " MB/s (checksum " << checksum << ")" << std::endl;
+}
+
+// Raw reader throughput: per-sample std::ifstream::read (previous Ntupler path) vs memory-mapped RawReader
+void BenchRaw(const int runNumber, const int maxEvents) {
+    std::vector<std::string> files = GetRawFiles(runNumber);
+    std::cout << "=== Raw reader benchmark, Run " << runNumber << " ===" << std::endl;
+
+    // Warm the page cache so both readers are compared at memory bandwidth, not disk bandwidth
+    double warmBytes = 0., warmSum = 0.;
+    for (const auto& fileName : files) {
+        RawReader reader(fileName);
+        for (int evt = 0; evt < reader.GetEntries(); evt++) {
+            const float* data = reader.GetEvent(evt);
+            // One sample per 4 kB page is enough to fault it in
+            for (int bin = 0; bin < RawReader::kSamplesPerEvent; bin += 1024) {
+                warmSum += data[bin];
+            }
+        }
+        warmBytes += reader.GetSize();
+    }
+    std::cout << "  Page cache warmed: " << warmBytes / 1e6 << " MB (checksum " << warmSum << ")" << std::endl;
+
+    TStopwatch timer;
+    double bytes = 0., checksum = 0.;
+    for (const auto& fileName : files) {
+        std::ifstream file(fileName, std::ios::binary);
+        if (!file) continue;
+        for (int evt = 0; maxEvents < 0 || evt < maxEvents; evt++) {
+            float value = 0.f;
+            for (int bin = 0; bin < RawReader::kSamplesPerEvent; bin++) {
+                file.read((char*)&value, sizeof(float));
+                checksum += value;
+            }
+            if (!file) break;
+            bytes += RawReader::kEventSize;
+        }
+    }
+    timer.Stop();
+    PrintResult("ifstream (per sample)", bytes, timer.RealTime(), checksum);
+
+    timer.Start();
+    bytes = 0.;
+    checksum = 0.;
+    for (const auto& fileName : files) {
+        RawReader reader(fileName);
+        int nEvents = (maxEvents < 0) ? reader.GetEntries() : std::min(maxEvents, reader.GetEntries());
+        for (int evt = 0; evt < nEvents; evt++) {
+            const float* data = reader.GetEvent(evt);
+            for (int bin = 0; bin < RawReader::kSamplesPerEvent; bin++) {
+                checksum += data[bin];
+            }
+            bytes += RawReader::kEventSize;
+        }
+    }
+    timer.Stop();
+    PrintResult("RawReader (mmap)     ", bytes, timer.RealTime(), checksum);
+}
+
+// Read the trigger and the loaded MCP channel of every event, as the analyzer does
+void ReadAll(DataIO& dataIO, const int maxEvents, const std::string& name) {
+    int nEvents = (maxEvents < 0) ? dataIO.GetEntries() : std::min(maxEvents, dataIO.GetEntries());
+    TStopwatch timer;
+    double checksum = 0.;
+    for (int evt = 0; evt < nEvents; evt++) {
+        if (!dataIO.GetEvent(evt)) continue;
+        WaveformView trigWave = dataIO.GetWaveformView(WaveformType::kTrigger);
+        WaveformView mcpWave = dataIO.GetWaveformView(WaveformType::kMcp);
+        checksum += trigWave[0] + mcpWave[0];
+    }
+    timer.Stop();
+
+    double bytes = 2. * nEvents * RawReader::kEventSize;
+    std::cout << "  " << name << ": " << nEvents << " events, "
+              << (timer.RealTime() > 0 ? nEvents / timer.RealTime() : 0.) << " events/s" << std::endl;
+    PrintResult(name, bytes, timer.RealTime(), checksum);
+}
+
+// Ntuple read throughput through DataIO (trigger + one MCP channel per event)
+void BenchRead(const int runNumber, const int channelNumber, const int maxEvents) {
+    std::cout << "=== Ntuple read benchmark, Run " << runNumber << ", Ch " << channelNumber << " ===" << std::endl;
+
+    DataIO dataIO;
+    if (!dataIO.Load(runNumber, channelNumber, false)) {
+        std::cerr << "Failed to open ntuple for Run " << runNumber << std::endl;
+        return;
+    }
+
+    ReadAll(dataIO, maxEvents, Form("Schema v%d", dataIO.GetSchemaVersion()));
+}
+
+// TTree vs RNTuple: conversion, file size and read speed for the same run
+void BenchFormat(const int runNumber, const int channelNumber, const int maxEvents) {
+    std::cout << "=== Ntuple format benchmark, Run " << runNumber << ", Ch " << channelNumber << " ===" << std::endl;
+
+    for (const std::string format : {"ttree", "rntuple"}) {
+        std::string ntuplePath = CONFIG_NTUPLE_PATH + "/bench_" + format;
+
+        Ntupler ntupler;
+        ntupler.SetFormat(format);
+        if (!ntupler.Convert(runNumber, maxEvents, "", ntuplePath)) {
+            std::cerr << "Failed to convert Run " << runNumber << " to " << format << std::endl;
+            continue;
+        }
+
+        struct stat st;
+        std::string fileName = Ntupler::GetPath(runNumber, ntuplePath);
+        double fileSize = (stat(fileName.c_str(), &st) == 0) ? st.st_size : 0.;
+        std::cout << "  " << format << " file size: " << fileSize / 1e6 << " MB" << std::endl;
+
+        DataIO dataIO;
+        dataIO.SetNtuplePath(ntuplePath);
+        if (!dataIO.Load(runNumber, channelNumber, false)) {
+            std::cerr << "Failed to open " << fileName << std::endl;
+            continue;
+        }
+        ReadAll(dataIO, maxEvents, format);
+    }
+}
+
+// Waveform correction + signal selection: vector Correct/GetStdDev/GetAmp vs the fused kernel
+void BenchCorrect(const int runNumber, const int channelNumber, const int maxEvents) {
+    std::cout << "=== Correct benchmark, Run " << runNumber << ", Ch " << channelNumber << " ===" << std::endl;
+
+    DataIO dataIO;
+    if (!dataIO.Load(runNumber, channelNumber, false)) {
+        std::cerr << "Failed to open ntuple for Run " << runNumber << std::endl;
+        return;
+    }
+
+    // Keep the MCP waveforms in memory so only the processing is timed
+    int nEvents = (maxEvents < 0) ? dataIO.GetEntries() : std::min(maxEvents, dataIO.GetEntries());
+    std::vector<std::vector<float>> waves;
+    for (int evt = 0; evt < nEvents; evt++) {
+        if (!dataIO.GetEvent(evt)) continue;
+        WaveformView mcpWave = dataIO.GetWaveformView(WaveformType::kMcp);
+        waves.emplace_back(mcpWave.begin(), mcpWave.end());
+    }
+
+    WaveformProcessor processor;
+    EventAnalyzer analyzer;
+    analyzer.fMcpWindowMin = CONFIG_MCP_WINDOW_MIN;
+    analyzer.fMcpWindowMax = CONFIG_MCP_WINDOW_MAX;
+    const int windowMin = analyzer.fMcpWindowMin;
+    const int windowMax = analyzer.fMcpWindowMax;
+
+    TStopwatch timer;
+    std::vector<float> legacyAmp, legacyRms;
+    int legacySignals = 0;
+    for (const auto& wave : waves) {
+        std::vector<float> corr = processor.Correct(wave);
+        float amp = analyzer.GetAmp(corr, windowMin, windowMax);
+        float rms = processor.GetStdDev(corr);
+        legacySignals += (amp > 4.0 * rms && processor.ToTCut(corr, windowMin, windowMax));
+        legacyAmp.push_back(amp);
+        legacyRms.push_back(rms);
+    }
+    timer.Stop();
+    double legacyTime = timer.RealTime();
+
+    timer.Start();
+    std::vector<float> corr;
+    std::vector<WaveformStats> stats;
+    stats.reserve(waves.size());
+    int fusedSignals = 0;
+    for (const auto& wave : waves) {
+        corr.resize(wave.size());
+        WaveformStats st = processor.Correct(wave, corr.data(), windowMin, windowMax);
+        fusedSignals += (st.Amplitude() > 4.0 * st.rms && processor.ToTCut(corr, windowMin, windowMax, st.rms));
+        stats.push_back(st);
+    }
+    timer.Stop();
+    double fusedTime = timer.RealTime();
+
+    float maxAmpDiff = 0., maxRmsDiff = 0.;
+    for (size_t i = 0; i < stats.size(); i++) {
+        maxAmpDiff = std::max(maxAmpDiff, std::abs(stats[i].Amplitude() - legacyAmp[i]));
+        maxRmsDiff = std::max(maxRmsDiff, std::abs(stats[i].rms - legacyRms[i]));
+    }
+
+    int n = std::max<int>(waves.size(), 1);
+    std::cout << "  vector Correct: " << legacyTime / n * 1e6 << " us/event, " << legacySignals << " signals" << std::endl;
+    std::cout << "  fused Correct:  " << fusedTime / n * 1e6 << " us/event, " << fusedSignals << " signals" << std::endl;
+    std::cout << "  Speedup: " << (fusedTime > 0 ? legacyTime / fusedTime : 0.) << "x, max |amp diff| " << maxAmpDiff
+              << " mV, max |rms diff| " << maxRmsDiff << " mV" << std::endl;
+}
+
+// Histogram-based FFT filter as it was before the persistent-plan engine (reference for BenchFFT)
+std::vector<float> HistogramFFTFilter(WaveformProcessor& processor, const std::vector<float>& waveform, float cutoffFrequency) {
+    int dimSize = WaveformProcessor::kFFTSize;
+
+    TH1F* waveOriginal = new TH1F("wave_original", "wave_original", dimSize, 0, 200.);
+    for (int i = 0; i < dimSize && i < (int)waveform.size(); i++) {
+        waveOriginal->SetBinContent(i+1, waveform.at(i));
+    }
+
+    TH1 *hr = waveOriginal->FFT(nullptr, "RE");
+    TH1 *him = waveOriginal->FFT(nullptr, "IM");
+    TH1D *hmag = (TH1D*)waveOriginal->FFT(nullptr, "MAG");
+    TVirtualFFT *fftSignal = TVirtualFFT::GetCurrentTransform();
+
+    double *reFull = new double[dimSize];
+    double *imFull = new double[dimSize];
+    fftSignal->GetPointsComplex(reFull, imFull);
+    for (int i = 0; i < dimSize; i++) {
+        double f = processor.LowPassFilter(cutoffFrequency, 8, i * processor.fSamplingRate / dimSize);
+        reFull[i] *= f;
+        imFull[i] *= f;
+    }
+
+    TVirtualFFT *fftBack = TVirtualFFT::FFT(1, &dimSize, "C2R M K");
+    fftBack->SetPointsComplex(reFull, imFull);
+    fftBack->Transform();
+    TH1 *hb = TH1::TransformHisto(fftBack, nullptr, "Re");
+    hb->Scale(1.0/dimSize);
+
+    std::vector<float> filtered;
+    for (int i = 0; i < dimSize; i++) {
+        filtered.push_back(hb->GetBinContent(i+1));
+    }
+
+    delete[] reFull;
+    delete[] imFull;
+    delete hb;
+    delete hr;
+    delete him;
+    delete hmag;
+    delete waveOriginal;
+    delete fftBack;
+
+    return filtered;
+}
+
+// FFT low-pass filter: histogram-based reference vs the persistent-plan engine
+void BenchFFT(const int runNumber, const int channelNumber, const int maxEvents) {
+    std::cout << "=== FFT filter benchmark, Run " << runNumber << ", Ch " << channelNumber << " ===" << std::endl;
+
+    DataIO dataIO;
+    if (!dataIO.Load(runNumber, channelNumber, false)) {
+        std::cerr << "Failed to open ntuple for Run " << runNumber << std::endl;
+        return;
+    }
+
+    WaveformProcessor processor;
+    int nEvents = (maxEvents < 0) ? dataIO.GetEntries() : std::min(maxEvents, dataIO.GetEntries());
+    std::vector<std::vector<float>> waves;
+    for (int evt = 0; evt < nEvents; evt++) {
+        if (!dataIO.GetEvent(evt)) continue;
+        waves.push_back(processor.Correct(dataIO.GetWaveformView(WaveformType::kMcp)));
+    }
+
+    TStopwatch timer;
+    std::vector<std::vector<float>> reference;
+    for (const auto& wave : waves) {
+        reference.push_back(HistogramFFTFilter(processor, wave, CONFIG_FFT_CUTOFF_FREQUENCY));
+    }
+    timer.Stop();
+    double histTime = timer.RealTime();
+
+    const int fftSize = WaveformProcessor::kFFTSize;
+    std::vector<float> filtered(waves.size() * fftSize);
+    timer.Start();
+    for (size_t evt = 0; evt < waves.size(); evt++) {
+        processor.FFTFilter(waves[evt].data(), filtered.data() + evt * fftSize, CONFIG_FFT_CUTOFF_FREQUENCY);
+    }
+    timer.Stop();
+    double engineTime = timer.RealTime();
+
+    // Same events again, accumulating the power spectrum as the analyzer does
+    std::vector<float> withSpectrum(waves.size() * fftSize);
+    PowerSpectrum spectrum(fftSize);
+    timer.Start();
+    for (size_t evt = 0; evt < waves.size(); evt++) {
+        processor.FFTFilter(waves[evt].data(), withSpectrum.data() + evt * fftSize, CONFIG_FFT_CUTOFF_FREQUENCY, &spectrum);
+    }
+    timer.Stop();
+    double spectrumTime = timer.RealTime();
+
+    // Same events through the many-transform plans, as the analyzer filters its batches
+    std::vector<float> batched(waves.size() * fftSize);
+    for (size_t evt = 0; evt < waves.size(); evt++) {
+        std::copy(waves[evt].begin(), waves[evt].begin() + fftSize, batched.begin() + evt * fftSize);
+    }
+    timer.Start();
+    processor.FilterBatch(batched.data(), batched.data(), waves.size(), fftSize, CONFIG_FFT_CUTOFF_FREQUENCY);
+    timer.Stop();
+    double batchTime = timer.RealTime();
+
+    float maxDiff = 0.;
+    float maxBatchDiff = 0.;
+    for (size_t evt = 0; evt < waves.size(); evt++) {
+        for (int i = 0; i < fftSize; i++) {
+            maxDiff = std::max(maxDiff, std::abs(filtered[evt * fftSize + i] - reference[evt][i]));
+            maxBatchDiff = std::max(maxBatchDiff, std::abs(batched[evt * fftSize + i] - filtered[evt * fftSize + i]));
+        }
+    }
+
+    int n = std::max<int>(waves.size(), 1);
+    std::cout << "  histogram FFT: " << histTime / n * 1e6 << " us/event" << std::endl;
+    std::cout << "  engine FFT:    " << engineTime / n * 1e6 << " us/event" << std::endl;
+    std::cout << "  engine FFT + spectrum: " << spectrumTime / n * 1e6 << " us/event (power spectrum of " 
+              << spectrum.GetEntries() << " waveforms)" << std::endl;
+    std::cout << "  batched FFT:   " << batchTime / n * 1e6 << " us/event (" << FFTFilterEngine::kBatchSize 
+              << " transforms per plan, max |diff| from engine " << maxBatchDiff << " mV)" << std::endl;
+    std::cout << "  Speedup: " << (engineTime > 0 ? histTime / engineTime : 0.) << "x, max |diff| " << maxDiff << " mV" << std::endl;
+}
+
+// Time-domain IIR low-pass vs the FFT filter on the same corrected MCP waveforms
+void BenchIIR(const int runNumber, const int channelNumber, const int maxEvents) {
+    std::cout << "=== IIR filter benchmark, Run " << runNumber << ", Ch " << channelNumber << " ===" << std::endl;
+
+    DataIO dataIO;
+    if (!dataIO.Load(runNumber, channelNumber, false)) {
+        std::cerr << "Failed to open ntuple for Run " << runNumber << std::endl;
+        return;
+    }
+
+    // Corrected waveforms back to back, one copy per filter so every filter runs in place
+    const int fftSize = WaveformProcessor::kFFTSize;
+    WaveformProcessor processor;
+    int nEvents = (maxEvents < 0) ? dataIO.GetEntries() : std::min(maxEvents, dataIO.GetEntries());
+    std::vector<float> waves;
+    std::vector<float> corr(RawReader::kSamplesPerEvent);
+    for (int evt = 0; evt < nEvents; evt++) {
+        if (!dataIO.GetEvent(evt)) continue;
+        WaveformView mcpWave = dataIO.GetWaveformView(WaveformType::kMcp);
+        corr.resize(mcpWave.size());
+        processor.Correct(mcpWave, corr.data(), 0, 0);
+        waves.insert(waves.end(), corr.begin(), corr.begin() + fftSize);
+    }
+    int n = waves.size() / fftSize;
+    std::vector<float> fftOut = waves, iirOut = waves, iirBatchOut = waves;
+
+    TStopwatch timer;
+    processor.fFilterMode = "fft";
+    for (int evt = 0; evt < n; evt++) {
+        processor.FilterWaveform(&fftOut[evt * fftSize], &fftOut[evt * fftSize], CONFIG_FFT_CUTOFF_FREQUENCY);
+    }
+    timer.Stop();
+    double fftTime = timer.RealTime();
+
+    processor.fFilterMode = "iir";
+    timer.Start();
+    for (int evt = 0; evt < n; evt++) {
+        processor.FilterWaveform(&iirOut[evt * fftSize], &iirOut[evt * fftSize], CONFIG_FFT_CUTOFF_FREQUENCY);
+    }
+    timer.Stop();
+    double iirTime = timer.RealTime();
+
+    timer.Start();
+    processor.FilterBatch(iirBatchOut.data(), iirBatchOut.data(), n, fftSize, CONFIG_FFT_CUTOFF_FREQUENCY);
+    timer.Stop();
+    double batchTime = timer.RealTime();
+
+    // The FFT filter is circular, so the first and last samples differ most; report the interior separately
+    const int edge = 50;
+    float maxDiff = 0., maxInnerDiff = 0., maxBatchDiff = 0.;
+    for (int evt = 0; evt < n; evt++) {
+        for (int i = 0; i < fftSize; i++) {
+            size_t idx = (size_t)evt * fftSize + i;
+            float diff = std::abs(iirOut[idx] - fftOut[idx]);
+            maxDiff = std::max(maxDiff, diff);
+            if (i >= edge && i < fftSize - edge) maxInnerDiff = std::max(maxInnerDiff, diff);
+            maxBatchDiff = std::max(maxBatchDiff, std::abs(iirBatchOut[idx] - iirOut[idx]));
+        }
+    }
+
+    n = std::max(n, 1);
+    std::cout << "  FFT filter:        " << fftTime / n * 1e6 << " us/event" << std::endl;
+    std::cout << "  IIR filter:        " << iirTime / n * 1e6 << " us/event (" 
+              << (iirTime > 0 ? fftTime / iirTime : 0.) << "x)" << std::endl;
+    std::cout << "  IIR filter, batch: " << batchTime / n * 1e6 << " us/event (" 
+              << (batchTime > 0 ? fftTime / batchTime : 0.) << "x)" << std::endl;
+    std::cout << "  max |IIR - FFT|: " << maxDiff << " mV, excluding " << edge << " edge samples: " << maxInnerDiff 
+              << " mV; max |batch - single|: " << maxBatchDiff << " mV" << std::endl;
+}
+
+// Histogram/TSpline3 CFD as it was before the array kernel (reference for BenchCFD, no visualization)
+float HistogramCFDTime(WaveformView waveform, float deltaT, float fitWindowMin, float fitWindowMax, 
+                       float fractionCFD, int delayCFD, bool isPositive) {
+    const int dimSize = waveform.size();
+    TH1D *hcfd = new TH1D("hcfd_bench", "CFD Signal", dimSize, 0, dimSize * deltaT);
+    TH1D *hinv = new TH1D("hinv_bench", "Inverted", dimSize, 0, dimSize * deltaT);
+    for (int i = 0; i < dimSize; i++) {
+        hinv->SetBinContent(i+1, -1. * fractionCFD * waveform[i]);
+        hcfd->SetBinContent(i+1, (i < delayCFD) ? 0. : waveform[i-delayCFD]);
+    }
+    hcfd->Add(hinv);
+    hcfd->GetXaxis()->SetRange(fitWindowMin, fitWindowMax);
+
+    int binLow = isPositive ? hcfd->GetMinimumBin() : hcfd->GetMaximumBin();
+    int binHigh = isPositive ? hcfd->GetMaximumBin() : hcfd->GetMinimumBin();
+
+    int searchEnd = -1;
+    if (isPositive) {
+        for (int i = binLow; i < dimSize; i++) {
+            if (hcfd->GetBinContent(i) <= 0) { searchEnd = i; break; }
+            if (i <= binHigh) { searchEnd = binHigh; break; }
+        }
+    } else {
+        for (int i = binHigh; i > 0; i--) {
+            if (hcfd->GetBinContent(i) >= 0) { searchEnd = i; break; }
+            if (i <= binLow) { searchEnd = binLow; break; }
+        }
+    }
+    if (searchEnd < 0) searchEnd = TMath::Max(1, binHigh - 10);
+
+    int fitBinLow = searchEnd;
+    int fitBinHigh = isPositive ? fitBinLow + 10 : binHigh;
+    if (fitBinHigh - fitBinLow < 5) {
+        fitBinLow = TMath::Max(1, fitBinLow - (5 - (fitBinHigh - fitBinLow)));
+    }
+
+    int low = std::min(fitBinLow, fitBinHigh), high = std::max(fitBinLow, fitBinHigh);
+    std::vector<double> xArr, yArr;
+    for (int bin = low; bin <= high; bin++) {
+        xArr.push_back(hcfd->GetBinCenter(bin));
+        yArr.push_back(hcfd->GetBinContent(bin));
+    }
+    TSpline3 *spline = new TSpline3("CFDSpline_bench", xArr.data(), yArr.data(), xArr.size());
+    hcfd->GetXaxis()->SetRange();
+
+    int bin = -1;
+    for (int i = fitBinLow; i < fitBinHigh; i++) {
+        double c0 = hcfd->GetBinContent(i), c1 = hcfd->GetBinContent(i+1);
+        if (c0 * c1 <= 0 && ((isPositive && c0 <= 0 && c1 > 0) || (!isPositive && c0 >= 0 && c1 < 0))) {
+            bin = i;
+            break;
+        }
+    }
+
+    float time = 0;
+    if (bin >= 0) {
+        double eps = 1e-3;
+        double xlow = hcfd->GetBinCenter(bin);
+        double xhigh = hcfd->GetBinCenter(bin + 1) + eps;
+        for (int iter = 0; (xhigh - xlow) >= eps && iter < 50; iter++) {
+            double xmid = (xlow + xhigh) / 2;
+            if (spline->Eval(xlow) * spline->Eval(xmid) < 0) xhigh = xmid;
+            else xlow = xmid;
+        }
+        time = xlow;
+    }
+
+    delete spline;
+    delete hinv;
+    delete hcfd;
+    return time;
+}
+
+// CFD timing of the trigger and MCP waveforms: histogram/TSpline3 reference vs the array kernel
+void BenchCFD(const int runNumber, const int channelNumber, const int maxEvents) {
+    std::cout << "=== CFD benchmark, Run " << runNumber << ", Ch " << channelNumber << " ===" << std::endl;
+
+    DataIO dataIO;
+    if (!dataIO.Load(runNumber, channelNumber, false)) {
+        std::cerr << "Failed to open ntuple for Run " << runNumber << std::endl;
+        return;
+    }
+
+    EventAnalyzer analyzer;
+    analyzer.fTriggerCfdFraction = CONFIG_TRIGGER_CFD_FRACTION;
+    analyzer.fTriggerCfdDelay = CONFIG_TRIGGER_CFD_DELAY;
+    analyzer.fMcpCfdFraction = CONFIG_MCP_CFD_FRACTION;
+    analyzer.fMcpCfdDelay = CONFIG_MCP_CFD_DELAY;
+    analyzer.fTriggerWindowMin = CONFIG_TRIGGER_WINDOW_MIN;
+    analyzer.fTriggerWindowMax = CONFIG_TRIGGER_WINDOW_MAX;
+    analyzer.fMcpWindowMin = CONFIG_MCP_WINDOW_MIN;
+    analyzer.fMcpWindowMax = CONFIG_MCP_WINDOW_MAX;
+    WaveformProcessor& processor = analyzer.fProcessor;
+
+    int nEvents = (maxEvents < 0) ? dataIO.GetEntries() : std::min(maxEvents, dataIO.GetEntries());
+    std::vector<std::vector<float>> trigWaves, mcpWaves;
+    for (int evt = 0; evt < nEvents; evt++) {
+        if (!dataIO.GetEvent(evt)) continue;
+        trigWaves.push_back(processor.Correct(dataIO.GetWaveformView(WaveformType::kTrigger)));
+        mcpWaves.push_back(processor.Correct(dataIO.GetWaveformView(WaveformType::kMcp)));
+    }
+    int n = trigWaves.size();
+
+    TStopwatch timer;
+    std::vector<float> reference;
+    for (int evt = 0; evt < n; evt++) {
+        reference.push_back(HistogramCFDTime(trigWaves[evt], processor.fDeltaT, analyzer.fTriggerWindowMin, analyzer.fTriggerWindowMax, 
+                                             analyzer.fTriggerCfdFraction, analyzer.fTriggerCfdDelay, true));
+        reference.push_back(HistogramCFDTime(mcpWaves[evt], processor.fDeltaT, analyzer.fMcpWindowMin, analyzer.fMcpWindowMax, 
+                                             analyzer.fMcpCfdFraction, analyzer.fMcpCfdDelay, false));
+    }
+    timer.Stop();
+    double histTime = timer.RealTime();
+
+    timer.Start();
+    std::vector<float> times;
+    times.reserve(2 * n);
+    for (int evt = 0; evt < n; evt++) {
+        times.push_back(analyzer.ComputeCFD(trigWaves[evt], analyzer.fTriggerWindowMin, analyzer.fTriggerWindowMax, 
+                                            analyzer.fTriggerCfdFraction, analyzer.fTriggerCfdDelay, true).time);
+        times.push_back(analyzer.ComputeCFD(mcpWaves[evt], analyzer.fMcpWindowMin, analyzer.fMcpWindowMax, 
+                                            analyzer.fMcpCfdFraction, analyzer.fMcpCfdDelay, false).time);
+    }
+    timer.Stop();
+    double kernelTime = timer.RealTime();
+
+    // The reference bisection stops within 1e-3 ps below the root
+    float maxDiff = 0.;
+    int nFound = 0, nMismatch = 0;
+    for (size_t i = 0; i < times.size(); i++) {
+        if ((times[i] != 0.) != (reference[i] != 0.)) {
+            nMismatch++;
+            continue;
+        }
+        if (times[i] != 0.) nFound++;
+        maxDiff = std::max(maxDiff, std::abs(times[i] - reference[i]));
+    }
+
+    n = std::max(n, 1);
+    std::cout << "  TH1D/TSpline3 CFD: " << histTime / n * 1e6 << " us/event (trigger + MCP)" << std::endl;
+    std::cout << "  array CFD kernel:  " << kernelTime / n * 1e6 << " us/event (" 
+              << (kernelTime > 0 ? histTime / kernelTime : 0.) << "x)" << std::endl;
+    std::cout << "  " << nFound << " crossings, max |dt| " << maxDiff << " ps, " 
+              << nMismatch << " waveforms found by only one method" << std::endl;
+}
+
+// Event loop configuration compared by the check mode
+struct CheckConfig {
+    std::string name;
+    int threads;
+    bool pipeline;
+    bool preselect;
+};
+
+// Analyse the run with every analysis and one loop configuration into Check_<name>_Run_<N>.root
+// and its feature file (no signal index, so every configuration reads every entry)
+bool RunCheck(const CheckConfig& config, const int runNumber, const int channelNumber, const int maxEvents,
+              std::string& outputFileName, std::string& featureFileName) {
+    std::string dir = Form("%s/run%d", CONFIG_OUTPUT_PATH.c_str(), runNumber);
+    gSystem->mkdir(dir.c_str(), true);
+    outputFileName = Form("%s/Check_%s_Run_%d.root", dir.c_str(), config.name.c_str(), runNumber);
+    featureFileName = Form("%s/Check_%s_Features_Run_%d.root", dir.c_str(), config.name.c_str(), runNumber);
+
+    DataIO dataIO;
+    dataIO.SetNtuplePath(CONFIG_NTUPLE_PATH);
+    dataIO.SetRawDataPath(CONFIG_RAWDATA_PATH);
+    if (!dataIO.Load(runNumber, channelNumber, false)) {
+        std::cerr << "Failed to open ntuple for Run " << runNumber << std::endl;
+        return false;
+    }
+    if (!dataIO.SetFile(outputFileName)) {
+        std::cerr << "Failed to create output file: " << outputFileName << std::endl;
+        return false;
+    }
+
+    AnalysisOptions analysis;
+    analysis.doWaveform = analysis.doWaveform2D = analysis.doToT = analysis.doTiming = true;
+    analysis.doAmplitude = analysis.doNpe = analysis.doAfterpulse = true;
+    analysis.threads = config.threads;
+    analysis.pipeline = config.pipeline;
+    analysis.preselect = config.preselect;
+    analysis.maxSnapshots = CONFIG_WAVEFORM_SNAPSHOTS;
+    analysis.featureFile = featureFileName;
+    analysis.printProgress = false;
+
+    TStopwatch timer;
+    RunAnalyzer runAnalyzer(analysis);
+    bool ok = runAnalyzer.Run(dataIO, runNumber, maxEvents);
+    dataIO.Close();
+    timer.Stop();
+    std::cout << "  " << config.name << ": " << timer.RealTime() << " s" << std::endl;
+    return ok;
+}
+
+// Bin by bin comparison of the histograms and parameters of two directories, recursively.
+// Objects of other classes (CFD canvases, the snapshot tree) are only counted in nSkipped.
+int CompareDirectories(TDirectory* reference, TDirectory* other, const std::string& path, int& nCompared, int& nSkipped) {
+    int nDiff = 0;
+    std::set<std::string> names;
+    for (TDirectory* dir : {reference, other}) {
+        TIter next(dir->GetListOfKeys());
+        while (TKey* key = (TKey*)next()) {
+            names.insert(key->GetName());
+        }
+    }
+
+    for (const std::string& name : names) {
+        std::string objectPath = path + name;
+        TKey* referenceKey = reference->GetKey(name.c_str());
+        TKey* otherKey = other->GetKey(name.c_str());
+        if (!referenceKey || !otherKey) {
+            std::cout << "    " << objectPath << ": only in the " << (referenceKey ? "reference" : "compared") << " file" << std::endl;
+            nDiff++;
+            continue;
+        }
+        if (std::string(referenceKey->GetClassName()) == "TDirectoryFile") {
+            nDiff += CompareDirectories(reference->GetDirectory(name.c_str()), other->GetDirectory(name.c_str()), 
+                                        objectPath + "/", nCompared, nSkipped);
+            continue;
+        }
+
+        std::string className = referenceKey->GetClassName();
+        if (className.rfind("TH", 0) != 0 && className.rfind("TParameter", 0) != 0) {
+            nSkipped++;
+            continue;
+        }
+        std::unique_ptr<TObject> a(referenceKey->ReadObj());
+        std::unique_ptr<TObject> b(otherKey->ReadObj());
+        if (auto* ha = dynamic_cast<TH1*>(a.get())) {
+            auto* hb = dynamic_cast<TH1*>(b.get());
+            nCompared++;
+            if (!hb || ha->GetNcells() != hb->GetNcells()) {
+                std::cout << "    " << objectPath << ": different binning" << std::endl;
+                nDiff++;
+                continue;
+            }
+            int nBins = 0, firstBin = -1;
+            for (int bin = 0; bin < ha->GetNcells(); bin++) {
+                if (ha->GetBinContent(bin) != hb->GetBinContent(bin) || ha->GetBinError(bin) != hb->GetBinError(bin)) {
+                    if (firstBin < 0) firstBin = bin;
+                    nBins++;
+                }
+            }
+            if (nBins > 0 || ha->GetEntries() != hb->GetEntries()) {
+                std::cout << "    " << objectPath << ": " << nBins << " bins differ";
+                if (firstBin >= 0) {
+                    std::cout << " (first: bin " << firstBin << ", " << ha->GetBinContent(firstBin) 
+                              << " vs " << hb->GetBinContent(firstBin) << ")";
+                }
+                std::cout << ", entries " << ha->GetEntries() << " vs " << hb->GetEntries() << std::endl;
+                nDiff++;
+            }
+        } else if (auto* pa = dynamic_cast<TParameter<double>*>(a.get())) {
+            auto* pb = dynamic_cast<TParameter<double>*>(b.get());
+            nCompared++;
+            if (!pb || pa->GetVal() != pb->GetVal()) {
+                std::cout << "    " << objectPath << ": " << pa->GetVal() << " vs " << (pb ? pb->GetVal() : 0.) << std::endl;
+                nDiff++;
+            }
+        } else if (auto* pa = dynamic_cast<TParameter<Long64_t>*>(a.get())) {
+            auto* pb = dynamic_cast<TParameter<Long64_t>*>(b.get());
+            nCompared++;
+            if (!pb || pa->GetVal() != pb->GetVal()) {
+                std::cout << "    " << objectPath << ": " << pa->GetVal() << " vs " << (pb ? pb->GetVal() : 0) << std::endl;
+                nDiff++;
+            }
+        } else {
+            nSkipped++;
+        }
+    }
+    return nDiff;
+}
+
+bool SameFeatures(const EventFeatures& a, const EventFeatures& b) {
+    return a.eventNum == b.eventNum && a.channel == b.channel && a.isSignal == b.isSignal &&
+           a.pedestal == b.pedestal && a.rms == b.rms && a.amp == b.amp && a.threshold == b.threshold &&
+           a.tot == b.tot && a.triggerTime == b.triggerTime && a.mcpTime == b.mcpTime && 
+           a.npe == b.npe && a.nAfterpulses == b.nAfterpulses;
+}
+
+// Row by row comparison of two feature trees
+int CompareFeatures(const std::string& referenceFile, const std::string& otherFile) {
+    FeatureReader reference, other;
+    if (!reference.Open(referenceFile) || !other.Open(otherFile)) return 1;
+    if (reference.GetEntries() != other.GetEntries()) {
+        std::cout << "    Features: " << reference.GetEntries() << " vs " << other.GetEntries() << " rows" << std::endl;
+        return 1;
+    }
+    long long nRows = 0, firstRow = -1;
+    for (long long entry = 0; entry < reference.GetEntries(); entry++) {
+        if (!SameFeatures(reference.GetEntry(entry), other.GetEntry(entry))) {
+            if (firstRow < 0) firstRow = entry;
+            nRows++;
+        }
+    }
+    if (nRows > 0) {
+        std::cout << "    Features: " << nRows << " rows differ (first: row " << firstRow << ")" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Row by row comparison of the waveform snapshots of two analysis files
+int CompareSnapshots(const std::string& referenceFile, const std::string& otherFile) {
+    SnapshotReader reference, other;
+    if (!reference.Open(referenceFile) || !other.Open(otherFile)) return 1;
+    if (reference.GetEntries() != other.GetEntries()) {
+        std::cout << "    " << kSnapshotTreeName << ": " << reference.GetEntries() << " vs " << other.GetEntries() << " rows" << std::endl;
+        return 1;
+    }
+    long long nRows = 0;
+    while (reference.Next() && other.Next()) {
+        const WaveformSnapshot& a = reference.Get();
+        const WaveformSnapshot& b = other.Get();
+        if (a.eventNum != b.eventNum || a.channel != b.channel ||
+            !std::equal(a.trig, a.trig + WaveformSnapshot::kSamples, b.trig) ||
+            !std::equal(a.mcp, a.mcp + WaveformSnapshot::kSamples, b.mcp)) {
+            nRows++;
+        }
+    }
+    if (nRows > 0) {
+        std::cout << "    " << kSnapshotTreeName << ": " << nRows << " rows differ" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Analyse the run serially without preselection, then with the preselection, on all cores and as a
+// pipeline, and compare each output with the first one. These are meant to be identical; returns false
+// if any histogram bin, parameter, snapshot or feature row differs.
+bool CheckOutputs(const int runNumber, const int channelNumber, const int maxEvents) {
+    std::cout << "=== Output check, Run " << runNumber << ", Ch " << channelNumber << " ===" << std::endl;
+
+    int nThreads = std::max(2u, std::thread::hardware_concurrency());
+    std::vector<CheckConfig> configs = {
+        {"serial", 1, false, false},
+        {"preselect", 1, false, true},
+        {"threads", nThreads, false, true},
+        {"pipeline", nThreads, true, true},
+    };
+    std::vector<std::string> outputFiles(configs.size()), featureFiles(configs.size());
+    for (size_t i = 0; i < configs.size(); i++) {
+        if (!RunCheck(configs[i], runNumber, channelNumber, maxEvents, outputFiles[i], featureFiles[i])) {
+            std::cerr << "Analysis with " << configs[i].name << " failed" << std::endl;
+            return false;
+        }
+    }
+
+    bool identical = true;
+    std::unique_ptr<TFile> reference(TFile::Open(outputFiles[0].c_str(), "READ"));
+    if (!reference || reference->IsZombie()) {
+        std::cerr << "Failed to open " << outputFiles[0] << std::endl;
+        return false;
+    }
+    for (size_t i = 1; i < configs.size(); i++) {
+        std::cout << "  " << configs[i].name << " (" << configs[i].threads << " threads, pipeline " 
+                  << (configs[i].pipeline ? "on" : "off") << ", preselect " << (configs[i].preselect ? "on" : "off") 
+                  << ") vs " << configs[0].name << ":" << std::endl;
+        std::unique_ptr<TFile> other(TFile::Open(outputFiles[i].c_str(), "READ"));
+        if (!other || other->IsZombie()) {
+            std::cerr << "Failed to open " << outputFiles[i] << std::endl;
+            return false;
+        }
+        int nCompared = 0, nSkipped = 0;
+        int nDiff = CompareDirectories(reference.get(), other.get(), "", nCompared, nSkipped);
+        other->Close();
+        nDiff += CompareSnapshots(outputFiles[0], outputFiles[i]);
+        nDiff += CompareFeatures(featureFiles[0], featureFiles[i]);
+        std::cout << "    " << nCompared << " histograms and parameters, snapshots and features: " 
+                  << (nDiff == 0 ? "identical" : Form("%d differences", nDiff)) 
+                  << " (" << nSkipped << " other objects not compared)" << std::endl;
+        identical = identical && nDiff == 0;
+    }
+    reference->Close();
+
+    std::cout << "  " << (identical ? "All outputs identical" : "Outputs DIFFER") << std::endl;
+    return identical;
+}
+
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " [mode] [runNumber] [channel] [maxEvents] [configFile]" << std::endl;
+        std::cout << "  mode: raw, read, format, correct, fft, iir, cfd, check" << std::endl;
+        return 1;
+    }
+
+    std::string mode = argv[1];
+    int runNumber = (argc > 2) ? atoi(argv[2]) : 101;
+    int channelNumber = (argc > 3) ? atoi(argv[3]) : 10;
+    int maxEvents = (argc > 4) ? atoi(argv[4]) : -1;
+    std::string configFile = (argc > 5) ? argv[5] : DEFAULT_CONFIG_FILE;
+
+    if (!Load(configFile)) {
+        std::cerr << "Failed to load config file, proceeding with default values." << std::endl;
+    }
+
+    if (mode == "raw") {
+        BenchRaw(runNumber, maxEvents);
+    } else if (mode == "read") {
+        BenchRead(runNumber, channelNumber, maxEvents);
+    } else if (mode == "format") {
+        BenchFormat(runNumber, channelNumber, maxEvents);
+    } else if (mode == "correct") {
+        BenchCorrect(runNumber, channelNumber, maxEvents);
+    } else if (mode == "fft") {
+        BenchFFT(runNumber, channelNumber, maxEvents);
+    } else if (mode == "iir") {
+        BenchIIR(runNumber, channelNumber, maxEvents);
+    } else if (mode == "cfd") {
+        BenchCFD(runNumber, channelNumber, maxEvents);
+    } else if (mode == "check") {
+        if (!CheckOutputs(runNumber, channelNumber, maxEvents)) return 1;
+    } else {
+        std::cerr << "Unknown benchmark mode: " << mode << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
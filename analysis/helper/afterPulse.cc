@@ -7,11 +7,11 @@
 #include <TLegend.h>
 #include <TColor.h>
 #include <TDirectory.h>
-#include <TKey.h>
 #include <TLine.h>
 #include <vector>
 #include <map>
 #include <cmath>
+#include "../../include/WaveformSnapshot.h"
 
 struct Data {
     int run_number;
@@ -21,29 +21,30 @@ struct Data {
     double entries;
 };
 
-float GetStdDev(TH1F* hist) {
-    // Calculate standard deviation from first 128 bins
+float GetStdDev(const float* wave) {
+    // Calculate standard deviation from first 128 samples
     double sum = 0.0;
-    for (int i = 1; i <= 128; i++) {
-        sum += hist->GetBinContent(i);
+    for (int i = 0; i < 128; i++) {
+        sum += wave[i];
     }
     double mean = sum / 128.0;
     
     double sumSquaredDiff = 0.0;
-    for (int i = 1; i <= 128; i++) {
-        double diff = hist->GetBinContent(i) - mean;
+    for (int i = 0; i < 128; i++) {
+        double diff = wave[i] - mean;
         sumSquaredDiff += diff * diff;
     }
     return std::sqrt(sumSquaredDiff / 128.0);
 }
 
-bool ToTCut(TH1F* waveHist, int fitWindowMin, int fitWindowMax) {
-    float threshold = -4.0 * GetStdDev(waveHist);
+// Window in bins of the former waveform histograms: sample i is bin i+1
+bool ToTCut(const float* wave, int fitWindowMin, int fitWindowMax) {
+    float threshold = -4.0 * GetStdDev(wave);
     int count = 0;
     int consecutive = 0;
 
     for (int i = fitWindowMin; i < fitWindowMax; i++) {
-        if (waveHist->GetBinContent(i) < threshold) {
+        if (wave[i - 1] < threshold) {
             count++;
             consecutive = std::max(consecutive, count);
         } else {
@@ -56,62 +57,43 @@ bool ToTCut(TH1F* waveHist, int fitWindowMin, int fitWindowMax) {
 }
 
 Data getData(int run_number, int HV, double B_field) {
-    TFile *file = new TFile(Form("../../output/250630_HVScan/run%d/Analysis_Run_%d.root", run_number, run_number), "READ");
-    
-    if (!file || !file->IsOpen()) {
-        std::cerr << "Error opening file for run " << run_number << std::endl;
-        Data empty_data = {run_number, HV, B_field, 0.0, 0.0};
-        return empty_data;
-    }
-    
-    TDirectory* mcpDir = (TDirectory*)file->Get("Waveforms_MCP");
-    if (!mcpDir) {
-        std::cerr << "Waveforms_MCP directory not found for run " << run_number << std::endl;
-        file->Close();
-        delete file;
+    // Waveform snapshots of the analyzer, MCP samples only
+    HRPPD::SnapshotReader reader;
+    if (!reader.Open(Form("../../output/250630_HVScan/run%d/Analysis_Run_%d.root", run_number, run_number), false)) {
+        std::cerr << "Error opening waveform snapshots for run " << run_number << std::endl;
         Data empty_data = {run_number, HV, B_field, 0.0, 0.0};
         return empty_data;
     }
     
-    TList* keyList = mcpDir->GetListOfKeys();
     int totalHistograms = 0;
     int afterpulseCount = 0;
     
-    TIter iter(keyList);
-    TKey* key;
-    
-    while ((key = (TKey*)iter())) {
-        TString histName = key->GetName();
+    while (reader.Next()) {
+        const HRPPD::WaveformSnapshot& snapshot = reader.Get();
+        if (snapshot.channel != 10) continue;
+        const float* wave = snapshot.mcp;
         
-        if (histName.Contains("MCP_Wave_Evt") && histName.Contains("_Ch10")) {
-            TH1F* waveHist = (TH1F*)mcpDir->Get(histName);
-            if (!waveHist) continue;
-            
-            totalHistograms++;
-            
-            double threshold = 4.0 * GetStdDev(waveHist);
-            bool isToT = ToTCut(waveHist, 680, 1000);
-            bool hasAfterpulse = false;
-
-            for (int i = 680; i < 1000; i++) {
-                double amplitude = std::abs(waveHist->GetBinContent(i));
-                if (amplitude > threshold && isToT) {
-                    hasAfterpulse = true;
-                    break;
-                }
-            }
-            
-            if (hasAfterpulse) {
-                afterpulseCount++;
+        totalHistograms++;
+        
+        double threshold = 4.0 * GetStdDev(wave);
+        bool isToT = ToTCut(wave, 680, 1000);
+        bool hasAfterpulse = false;
+
+        for (int i = 680; i < 1000; i++) {
+            double amplitude = std::abs(wave[i - 1]);
+            if (amplitude > threshold && isToT) {
+                hasAfterpulse = true;
+                break;
             }
         }
+        
+        if (hasAfterpulse) {
+            afterpulseCount++;
+        }
     }
     
     double ratio = (double)afterpulseCount / (double)totalHistograms * 100;
     
-    file->Close();
-    delete file;
-    
     Data data;
     data.run_number = run_number;
     data.HV = HV;
@@ -0,0 +1,32 @@
+# Writes OUTPUT, a header defining HRPPD_VERSION as the git description of SOURCE_DIR.
+# Run on every build (hrppd_version target in CMakeLists.txt); the header is only rewritten
+# when the description changes, so the library is only relinked after a commit, pull or edit.
+execute_process(COMMAND git describe --always --dirty
+                WORKING_DIRECTORY ${SOURCE_DIR}
+                OUTPUT_VARIABLE HRPPD_GIT_VERSION
+                OUTPUT_STRIP_TRAILING_WHITESPACE
+                ERROR_QUIET)
+if(NOT HRPPD_GIT_VERSION)
+    set(HRPPD_GIT_VERSION "unknown")
+endif()
+
+# "-dirty" alone does not tell two sets of uncommitted edits apart: add a hash of the diff
+if(HRPPD_GIT_VERSION MATCHES "-dirty$")
+    execute_process(COMMAND git diff HEAD
+                    WORKING_DIRECTORY ${SOURCE_DIR}
+                    OUTPUT_VARIABLE HRPPD_GIT_DIFF
+                    ERROR_QUIET)
+    string(MD5 HRPPD_DIFF_HASH "${HRPPD_GIT_DIFF}")
+    string(SUBSTRING ${HRPPD_DIFF_HASH} 0 12 HRPPD_DIFF_HASH)
+    set(HRPPD_GIT_VERSION "${HRPPD_GIT_VERSION}-${HRPPD_DIFF_HASH}")
+endif()
+
+set(HRPPD_VERSION_TEXT "// Generated by cmake/Version.cmake on every build\n#define HRPPD_VERSION \"${HRPPD_GIT_VERSION}\"\n")
+set(HRPPD_OLD_TEXT "")
+if(EXISTS ${OUTPUT})
+    file(READ ${OUTPUT} HRPPD_OLD_TEXT)
+endif()
+if(NOT HRPPD_OLD_TEXT STREQUAL HRPPD_VERSION_TEXT)
+    file(WRITE ${OUTPUT} "${HRPPD_VERSION_TEXT}")
+    message(STATUS "Library version: ${HRPPD_GIT_VERSION}")
+endif()
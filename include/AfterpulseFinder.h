@@ -0,0 +1,36 @@
+#ifndef HRPPD_AFTERPULSEFINDER_H
+#define HRPPD_AFTERPULSEFINDER_H
+
+#include <vector>
+#include "WaveformView.h"
+
+
+namespace HRPPD {
+    // One pulse of a corrected MCP waveform (sample indices)
+    struct Pulse {
+        int start = 0;          // First sample below -threshold
+        int width = 0;          // Consecutive samples below -threshold
+        int peakIndex = 0;      // Sample of the minimum
+        float amplitude = 0.;   // |minimum| (mV)
+    };
+
+    // Streaming multi-pulse finder for afterpulses. One pass over [fWindowMin, fWindowMax) of a
+    // corrected (negative) waveform: every run of samples below -threshold whose time over
+    // threshold exceeds fMinToT is a pulse. The defaults are the window and ToT cut of
+    // analysis/helper/afterPulse.cc, which counted an event as afterpulsing if it had such a run;
+    // its loop over bins 680..999 of the former waveform histograms reads samples 679..998.
+    //
+    // Thread safety: Find() is const and keeps no state; one instance may be shared by threads.
+    class AfterpulseFinder {
+    public:
+        // Replace the contents of pulses by the pulses in the window, in time order; returns their number
+        int Find(WaveformView waveform, float threshold, std::vector<Pulse>& pulses) const;
+
+        int fWindowMin = 679;       // Search window [fWindowMin, fWindowMax) (samples)
+        int fWindowMax = 999;
+        float fMinToT = 800.;       // Minimum time over threshold of a pulse (ps)
+        float fDeltaT = 200.;       // Sampling interval (ps)
+    };
+}
+
+#endif // HRPPD_AFTERPULSEFINDER_H
@@ -0,0 +1,41 @@
+#ifndef HRPPD_ANALYSISSETUP_H
+#define HRPPD_ANALYSISSETUP_H
+
+#include <string>
+#include <vector>
+
+
+namespace HRPPD {
+    struct AnalysisOptions;
+
+    // Command line options given as "--name value", shared by the analyzer and the batch driver.
+    // Each program accepts its own subset and sets its defaults before ParseCommandLine.
+    struct CommandLineOptions {
+        std::string source = "ntuple";   // --source ntuple|raw
+        int threads = 1;                 // --threads N (event loop threads; batch: pool threads)
+        int runThreads = 4;              // --run-threads N (batch: threads, and so workers, per run)
+        bool pipeline = false;           // --pipeline on|off (reader -> compute pool -> writer stages)
+        bool rehistogram = false;        // --rehistogram on|off (histograms from the feature tree, no waveform pass)
+        bool force = false;              // --force on|off (analyse runs whose output is up to date)
+    };
+
+    // Split argv into the positional arguments and the options named in accepted (e.g. "--force").
+    // Prints the offending argument and returns false on an unknown option or an invalid value.
+    bool ParseCommandLine(int argc, char** argv, const std::vector<std::string>& accepted,
+                          CommandLineOptions& options, std::vector<std::string>& args);
+
+    // "<output_path>/run<N>/<name>_Run_<N>.root", e.g. name "Analysis" or "Features"
+    std::string GetRunFile(const std::string& name, int runNumber);
+
+    // Analysis options of a run. analysisType is "all" or flags such as "wta"; flags that select no
+    // analysis take the do_* keys of the loaded configuration. The feature file (f or do_features)
+    // and the signal index file are those of the run. Threads and pipeline come from options.
+    AnalysisOptions MakeAnalysisOptions(const std::string& analysisType, int runNumber, const CommandLineOptions& options);
+
+    // True if the Analysis output of the run has the provenance the analysis would write now, so the
+    // run can be skipped; prints the skip or the changed provenance lines of an earlier output
+    bool IsUpToDate(int runNumber, const std::vector<int>& channels, int maxEvents,
+                    const AnalysisOptions& analysis, const std::string& source);
+}
+
+#endif // HRPPD_ANALYSISSETUP_H
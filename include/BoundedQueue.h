@@ -0,0 +1,89 @@
+#ifndef HRPPD_BOUNDEDQUEUE_H
+#define HRPPD_BOUNDEDQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+
+namespace HRPPD {
+    // Fixed-capacity lock-free multi-producer/multi-consumer queue (D. Vyukov's bounded MPMC queue).
+    // Each cell carries a sequence number telling producers and consumers whose turn it is, so
+    // TryPush/TryPop cost one CAS on the shared position and never block. A full queue makes
+    // TryPush fail, which is how a slow downstream stage pushes back on its producers.
+    template <typename T>
+    class BoundedQueue {
+    public:
+        // Capacity is rounded up to a power of two
+        explicit BoundedQueue(size_t capacity) {
+            size_t size = 2;
+            while (size < capacity) size *= 2;
+            fMask = size - 1;
+            fCells.reset(new Cell[size]);
+            for (size_t i = 0; i < size; i++) {
+                fCells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        BoundedQueue(const BoundedQueue&) = delete;
+        BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+        size_t GetCapacity() const { return fMask + 1; }
+
+        // False if the queue is full
+        bool TryPush(const T& value) {
+            Cell* cell;
+            size_t pos = fEnqueuePos.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &fCells[pos & fMask];
+                size_t seq = cell->sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+                if (diff == 0) {
+                    if (fEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = fEnqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+            cell->value = value;
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // False if the queue is empty
+        bool TryPop(T& value) {
+            Cell* cell;
+            size_t pos = fDequeuePos.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &fCells[pos & fMask];
+                size_t seq = cell->sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+                if (diff == 0) {
+                    if (fDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = fDequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+            value = cell->value;
+            cell->sequence.store(pos + fMask + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        std::unique_ptr<Cell[]> fCells;
+        size_t fMask = 0;
+        // Producers and consumers update different cache lines
+        alignas(64) std::atomic<size_t> fEnqueuePos{0};
+        alignas(64) std::atomic<size_t> fDequeuePos{0};
+    };
+}
+
+#endif // HRPPD_BOUNDEDQUEUE_H
@@ -0,0 +1,100 @@
+#ifndef HRPPD_CFDSPLINE_H
+#define HRPPD_CFDSPLINE_H
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace HRPPD {
+    const int kMaxSplinePoints = 64;
+
+    // Not-a-knot cubic spline through equally spaced points, the interpolant TSpline3 builds by default.
+    // With uniform spacing the end conditions reduce the system for the second derivatives m to
+    // 6 m[1] = r[1], 6 m[n-2] = r[n-2] and m[i-1] + 4 m[i] + m[i+1] = r[i] in between.
+    struct CFDSpline {
+        double x0 = 0.;
+        double h = 1.;
+        int n = 0;
+        double y[kMaxSplinePoints];
+        double m[kMaxSplinePoints];
+
+        void Build() {
+            std::fill(m, m + n, 0.);
+            if (n < 3) return;  // Straight line
+        
+            double r[kMaxSplinePoints];
+            for (int i = 1; i < n - 1; i++) {
+                r[i] = 6. * (y[i-1] - 2. * y[i] + y[i+1]) / (h * h);
+            }
+            if (n == 3) {  // Parabola
+                std::fill(m, m + n, r[1] / 6.);
+                return;
+            }
+        
+            m[1] = r[1] / 6.;
+            m[n-2] = r[n-2] / 6.;
+        
+            // Thomas algorithm for m[2..n-3]
+            double cp[kMaxSplinePoints];
+            double dp[kMaxSplinePoints];
+            for (int i = 2; i <= n - 3; i++) {
+                double rhs = r[i];
+                if (i == 2) rhs -= m[1];
+                if (i == n - 3) rhs -= m[n-2];
+                double denom = 4. - ((i > 2) ? cp[i-1] : 0.);
+                cp[i] = 1. / denom;
+                dp[i] = (rhs - ((i > 2) ? dp[i-1] : 0.)) / denom;
+            }
+            for (int i = n - 3; i >= 2; i--) {
+                m[i] = dp[i] - ((i < n - 3) ? cp[i] * m[i+1] : 0.);
+            }
+        
+            m[0] = 2. * m[1] - m[2];
+            m[n-1] = 2. * m[n-2] - m[n-3];
+        }
+
+        // Cubic of segment i as y[i] + t (b + t (c + t d)), t = x - x_i
+        void Segment(int i, double& b, double& c, double& d) const {
+            b = (y[i+1] - y[i]) / h - h * (2. * m[i] + m[i+1]) / 6.;
+            c = m[i] / 2.;
+            d = (m[i+1] - m[i]) / (6. * h);
+        }
+
+        double Eval(double x) const {
+            int i = std::min(std::max((int)std::floor((x - x0) / h), 0), n - 2);
+            double t = x - (x0 + i * h);
+            double b, c, d;
+            Segment(i, b, c, d);
+            return y[i] + t * (b + t * (c + t * d));
+        }
+
+        // Zero of segment i, whose end points have opposite signs (or one is zero).
+        // Newton steps from the linear estimate, falling back to bisection when a step leaves the bracket.
+        double Root(int i) const {
+            if (y[i] == 0.) return x0 + i * h;
+            if (y[i+1] == 0.) return x0 + (i + 1) * h;
+        
+            double b, c, d;
+            Segment(i, b, c, d);
+            double lo = 0., hi = h;
+            double t = h * y[i] / (y[i] - y[i+1]);
+            for (int iter = 0; iter < 20; iter++) {
+                double f = y[i] + t * (b + t * (c + t * d));
+                if (f == 0.) break;
+                if ((f < 0.) == (y[i] < 0.)) lo = t; else hi = t;
+            
+                double fp = b + t * (2. * c + 3. * t * d);
+                double next = (fp != 0.) ? t - f / fp : 0.5 * (lo + hi);
+                if (!(next > lo && next < hi)) next = 0.5 * (lo + hi);
+                if (std::abs(next - t) < 1e-9 * h) {
+                    t = next;
+                    break;
+                }
+                t = next;
+            }
+            return x0 + i * h + t;
+        }
+    };
+}
+
+#endif // HRPPD_CFDSPLINE_H
@@ -0,0 +1,72 @@
+#ifndef HRPPD_CFDVISUALIZER_H
+#define HRPPD_CFDVISUALIZER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace HRPPD {
+    class DataIO;
+
+    // What is needed to draw one CFD crossing after the event loop (filled by EventAnalyzer::GetCFDTime)
+    struct CFDRecord {
+        int eventNum = -1;
+        int channel = -1;
+        float time = 0.;            // Zero-crossing time (ps), 0 if none was found
+        int crossingBin = -1;       // Last bin before the crossing, -1 if none
+        int fitBinLow = 0;          // Spline range (1-based bins)
+        int fitBinHigh = 0;
+        float fitWindowMin = 0.;    // Search window (bins)
+        float fitWindowMax = 0.;
+        float deltaT = 0.;          // Bin width (ps)
+        std::vector<double> cfd;    // CFD signal, cfd[b-1] for bin b
+    };
+
+    // Keeps a uniform random subset of at most maxRecords CFD records with a zero crossing and
+    // renders them to canvases once the event loop is done, so the loop does no graphics.
+    // Events without a crossing take no sample slot, so maxRecords plots are written whenever
+    // that many crossings were offered.
+    // Every candidate gets a pseudo-random key from the run number, its event number and the
+    // seed, and the records with the smallest keys are kept, so runs sample different events. The sample depends only on which events were
+    // offered, not on their order: per-thread visualizers combined with Merge() hold the same
+    // records as a serial run. Not shared between threads: give each worker its own.
+    class CFDVisualizer {
+    public:
+        CFDVisualizer(const std::string& dirName, int maxRecords, int runNumber, unsigned int seed = 4357);
+
+        // Record to fill for candidate eventNum, or nullptr if it is not sampled. The record
+        // must be filled completely and stays valid until the next call to Next().
+        CFDRecord* Next(int eventNum);
+        // Add the record of the last Next() to the sample if it has a crossing
+        // (it may replace an earlier one); no-op if Next() returned nullptr
+        void Keep();
+
+        // Add the candidates and sampled records of other (e.g. a worker's visualizer)
+        void Merge(const CFDVisualizer& other);
+
+        long GetSeen() const { return fSeen; }
+        const std::vector<CFDRecord>& GetRecords() const { return fRecords; }
+
+        // Draw the sampled records, ordered by event, into dirName of the output file,
+        // as canvases CFD_run<R>_ch<C>_evt<N>. Uses ROOT graphics and gStyle: not thread-safe.
+        void Write(DataIO& dataIO) const;
+
+    private:
+        CFDRecord* Insert(uint64_t key);
+
+        std::string fDirName;
+        int fMaxRecords;
+        int fRunNumber;
+        unsigned int fSeed;
+        long fSeen = 0;
+        std::vector<CFDRecord> fRecords;
+        std::vector<uint64_t> fKeys;    // Sample key of each record
+        int fMaxSlot = 0;               // Record with the largest key, replaced first
+        CFDRecord fPending;             // Record handed out by Next(), until Keep()
+        uint64_t fPendingKey = 0;
+        bool fHasPending = false;
+    };
+}
+
+#endif // HRPPD_CFDVISUALIZER_H
@@ -2,6 +2,7 @@
 #define CONFIG_H
 
 #include <string>
+#include <vector>
 #include <map>
 #include <fstream>
 #include <sstream>
@@ -14,6 +15,9 @@ namespace HRPPD {
 extern std::string CONFIG_OUTPUT_PATH;
 extern std::string CONFIG_RAWDATA_PATH;     
 extern std::string CONFIG_NTUPLE_PATH;
+extern int CONFIG_NTUPLE_THREADS;          // Worker threads for ntuplizing (<= 1: serial)
+extern std::string CONFIG_NTUPLE_FORMAT;   // Ntuple format written by Ntupler: ttree | rntuple
+extern std::string CONFIG_NTUPLE_CHANNELS; // MCP channels written by Ntupler: "all" or e.g. "0,5,10"
 
 extern float CONFIG_TRIGGER_CFD_FRACTION;
 extern int CONFIG_TRIGGER_CFD_DELAY;
@@ -27,6 +31,7 @@ extern int CONFIG_MCP_WINDOW_MAX;
 
 extern float CONFIG_FFT_CUTOFF_FREQUENCY;
 extern bool CONFIG_APPLY_FFT_FILTER;
+extern std::string CONFIG_FILTER_MODE;     // Low-pass filter implementation: fft | iir
 
 extern float CONFIG_CALIBRATION_CONSTANT;  // ADC to mV conversion constant
 extern float CONFIG_DELTA_T;               // Sampling interval (ps)
@@ -38,10 +43,29 @@ extern bool CONFIG_DO_TOT;
 extern bool CONFIG_DO_TIMING;
 extern bool CONFIG_DO_AMPLITUDE;
 extern bool CONFIG_DO_NPE;
+extern bool CONFIG_DO_AFTERPULSE;
+extern int CONFIG_AFTERPULSE_WINDOW_MIN;     // Afterpulse search window [min, max) (sample)
+extern int CONFIG_AFTERPULSE_WINDOW_MAX;
+extern float CONFIG_AFTERPULSE_MIN_TOT;     // Minimum time over threshold of an afterpulse (ps)
+extern bool CONFIG_PRESELECT;               // Reject non-signal waveforms before the full correction
+extern bool CONFIG_SIGNAL_INDEX;            // Cache the signal entries of each run (SignalIndex_Run_<N>.root)
+extern bool CONFIG_DO_FEATURES;             // Write the per-event feature tree (Features_Run_<N>.root)
+extern float CONFIG_REHIST_THRESHOLD;       // --rehistogram selection: amplitude above this many baseline RMS
+extern float CONFIG_REHIST_MIN_TOT;         // --rehistogram selection: minimum ToT (ps)
+extern int CONFIG_WAVEFORM_SNAPSHOTS;       // Waveform snapshots stored per channel (-1: every signal event)
+extern int CONFIG_CFD_VISUALIZE_EVENTS;     // CFD canvases kept per channel (reservoir sample, 0: none)
 
 // Configuration file loading function
 bool Load(const std::string& configFile);
 
+// Effective value of every configuration key that can change an analysis output, one
+// "key value" line each (output_path, ntuple_threads, preselect, signal_index and rehist_* leave it unchanged)
+std::string GetConfigText();
+
+// Parse a channel list ("all" or comma separated, e.g. "0,5,10") into MCP channel numbers.
+// Returns an empty list if any entry is not a channel in [0, 15] or a channel is listed twice.
+std::vector<int> ParseChannels(const std::string& channelList);
+
 } // namespace HRPPD
 
 #endif // CONFIG_H 
\ No newline at end of file
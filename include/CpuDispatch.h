@@ -0,0 +1,25 @@
+#ifndef HRPPD_CPUDISPATCH_H
+#define HRPPD_CPUDISPATCH_H
+
+// AVX2 kernels are compiled per function (HRPPD_AVX2_TARGET) rather than with -mavx2 for the
+// whole library, so no other code is vectorized with AVX2, and they are only called when the
+// CPU running the binary supports AVX2 (CpuHasAVX2). HRPPD_ENABLE_AVX2 is set by CMake.
+#if defined(HRPPD_ENABLE_AVX2) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HRPPD_AVX2_KERNELS 1
+#define HRPPD_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+
+namespace HRPPD {
+    inline bool CpuHasAVX2() {
+#if defined(HRPPD_AVX2_KERNELS)
+        static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+        return hasAVX2;
+#else
+        return false;
+#endif
+    }
+}
+
+#endif // HRPPD_CPUDISPATCH_H
@@ -7,41 +7,128 @@
 #include "TFile.h"
 #include "TTree.h"
 #include "TH1.h"
+#include "TBufferFile.h"
+#include <ROOT/RNTuple.hxx>
+#include "RawReader.h"
+#include "WaveformView.h"
 
 
 namespace HRPPD {
     class Ntupler;
     
+    // One DataIO per thread: it owns its input/output files, read buffers and current event.
+    // Separate instances may read the same run concurrently (ROOT::EnableThreadSafety() first).
     class DataIO {
     public:
+        // Storage the current run is served from
+        enum class Backend { kNone, kTTree, kRNTuple, kRaw };
+        
+        // Where Load looks for a run: the ROOT ntuple (converted on demand) or the raw .dat files
+        enum class Source { kNtuple, kRaw };
+        
+        // Entry range size of GetClusterRanges for inputs without TTree clusters
+        static const int kChunkSize = 1024;
+        
         DataIO();
         ~DataIO();
         
         // File management
+        void SetSource(Source source) { fSource = source; }
         bool Load(int runNumber, const int channelNumber, bool autoNtuplize = true);
+        // Load the trigger and several MCP channels, all read by each GetEvent
+        bool Load(int runNumber, const std::vector<int>& channels, bool autoNtuplize = true);
+        // Open the run and channel loaded in other, from the same source, for another thread
+        bool OpenInput(const DataIO& other);
         bool SetFile(const std::string& fileName);
         void Close(const std::string& fileName = "");
         
         // Event data access
         bool GetEvent(int eventIndex);
         int GetEntries() const;
+        // Consecutive [first, last) entry ranges covering the first nEntries entries, aligned to
+        // the TTree clusters (kChunkSize entries for RNTuple and raw input)
+        std::vector<std::pair<int, int>> GetClusterRanges(int nEntries) const;
         std::vector<float> GetWaveform(const std::string& type) const;
+        // Valid until the next GetEvent; channelIndex is the position in the loaded channel list
+        WaveformView GetWaveformView(WaveformType type, int channelIndex = 0) const;
+        const std::vector<int>& GetChannels() const { return fChannels; }
+        // Files the loaded run is read from: the ntuple, or the raw trigger and channel files
+        std::vector<std::string> GetInputFiles() const;
+        int GetSchemaVersion() const { return fSchemaVersion; }
+        Backend GetBackend() const { return fBackend; }
         
         // Output management
-        void Save(TH1* hist, const std::string& dirName = "");
+        void Save(TObject* obj, const std::string& dirName = "");
         void SetDir(const std::string& dirName);
+        TDirectory* GetDir(const std::string& dirName);  // Created if missing, nullptr without output file
         void SetPath(const std::string& outputPath);
+        void SetNtuplePath(const std::string& ntuplePath);
+        void SetRawDataPath(const std::string& rawDataPath);
         
     private:
+        // Basket-at-a-time reader for a fixed-size leaf-list branch (schema v2).
+        // Holds one deserialized basket; entries are served straight from it.
+        struct BulkBranch {
+            TBranch* branch = nullptr;
+            std::unique_ptr<TBufferFile> buffer;
+            Long64_t first = 0;   // First entry held in buffer
+            Long64_t count = 0;   // Number of entries held in buffer
+            int entrySize = 0;    // Bytes per entry
+        };
+        
+        bool InitBulk(BulkBranch& bulk, const char* branchName, int entrySize);
+        const char* ReadBulk(BulkBranch& bulk, Long64_t entry);
+        
+        using FloatView = ROOT::Experimental::RNTupleView<float>;
+        bool LoadRNTuple(const std::string& ntuplePath);
+        const float* MapWaveform(FloatView& view, Long64_t entry, float* staging);
+        bool LoadRaw(int runNumber);
+        void UseBranchBuffers();
+        void CloseInput();
+        
+        Source fSource = Source::kNtuple;
+        Backend fBackend = Backend::kNone;
         TFile* fInputFile = nullptr;
         TFile* fOutputFile = nullptr;
         TTree* fTree = nullptr; 
         
+        // RNTuple input; waveform columns are mapped page-wise, without per-entry copies
+        std::string fNTupleFileName;
+        std::unique_ptr<ROOT::Experimental::RNTupleReader> fNTuple;
+        std::unique_ptr<ROOT::Experimental::RNTupleView<int>> fEventView;
+        std::unique_ptr<FloatView> fTriggerView;
+        std::vector<std::unique_ptr<FloatView>> fMcpViews;
+        
+        // Raw input, served straight from the memory-mapped TR_0_0.dat and wave_N.dat
+        RawReader fTriggerReader;
+        std::vector<RawReader> fMcpReaders;
+        
         int fEventNum = 0;
+        int fRunNumber = 0;
+        std::vector<int> fChannels;     // Loaded MCP channels
+        int fSchemaVersion = 0;
+        
+        // Schema v1 branch buffers, one per loaded channel
         std::vector<float>* fTriggerWaveform = nullptr;
-        std::vector<float>* fMcpWaveform = nullptr;
-        int fChannelNumber = 0;
+        std::vector<std::vector<float>*> fMcpWaveform;
+        
+        // Schema v2 branch buffers (used when the bulk path is unavailable),
+        // also staging for RNTuple waveforms that straddle a page boundary.
+        // fMcpArray holds kMaxSamples per loaded channel.
+        static const int kMaxSamples = 1024;
+        float fTriggerArray[kMaxSamples];
+        std::vector<float> fMcpArray;
+        bool fUseBulk = false;
+        BulkBranch fEventBulk;
+        BulkBranch fTriggerBulk;
+        std::vector<BulkBranch> fMcpBulk;
+        
+        // Current event, valid until the next GetEvent
+        const float* fTriggerData = nullptr;
+        std::vector<const float*> fMcpData;
+        int fNSamples = 0;
         
+        std::string fRawDataPath = "./rawdata";
         std::string fNtuplePath = "./data";
         std::string fOutputPath = "./output";
         
@@ -7,13 +7,23 @@
 #include <string>
 #include <TH1F.h>
 #include <TDirectory.h>
-#include <TSpline.h>
-#include <TH1D.h>
-#include <TGraph.h>
 
 
 namespace HRPPD {
 
+// Outcome of the CFD timing kernel. Bins are 1-based, as in the former CFD histogram.
+struct CFDResult {
+    float time = 0.;        // Zero-crossing time (ps), 0 if no crossing was found
+    int crossingBin = -1;   // Last bin before the crossing, -1 if none
+    int fitBinLow = 0;      // Bins the interpolating spline runs through
+    int fitBinHigh = 0;
+};
+
+struct CFDRecord;
+
+// Thread safety: the analysis methods are const, create no ROOT objects in gDirectory and
+// read only the public parameters (and fProcessor), so they may run concurrently on one
+// instance. Parameters must not be changed while workers use the instance.
 class EventAnalyzer {
 public:
     EventAnalyzer();
@@ -22,19 +32,21 @@ public:
     bool Init();
     
     // Functions moved from WaveformProcessor
-    float GetAmp(const std::vector<float>& waveform, int windowMin, int windowMax);
-    float GetNpe(const std::vector<float>& waveform, int windowMin, int windowMax);
+    float GetAmp(WaveformView waveform, int windowMin, int windowMax) const;
+    float GetNpe(WaveformView waveform, int windowMin, int windowMax) const;
 
     // Timing analysis functions moved from WaveformProcessor
-    TSpline3* CreateCFDSpline(TH1D* hcfd, int binLow, int binHigh, const char* name);
-    void VisualizeSpline(TH1D* hcfd, int binLow, int binHigh, TSpline3* spline, 
-                       TGraph* pointGraph, TGraph* splineGraph);
-    float GetCFDTime(const std::vector<float>& waveform, int channel, int eventNum, 
+    // CFD zero-crossing time (ps). If record is given (e.g. from CFDVisualizer::Next) it is filled
+    // with what is needed to draw the crossing later; nothing is drawn here.
+    float GetCFDTime(WaveformView waveform, int channel, int eventNum, 
                          float fitWindowMin, float fitWindowMax, 
                          float fractionCFD, int delayCFD, 
-                         bool isPositive, bool isVisualize, 
-                         std::string dirName);
-    float GetTime(const std::vector<float>& waveform, float fractionCFD, int windowMin, int windowMax);
+                         bool isPositive, CFDRecord* record = nullptr) const;
+    // Allocation-free CFD kernel used by GetCFDTime (no histograms, splines or gDirectory objects)
+    CFDResult ComputeCFD(WaveformView waveform, float fitWindowMin, float fitWindowMax, 
+                         float fractionCFD, int delayCFD, bool isPositive, 
+                         CFDRecord* record = nullptr) const;
+    float GetTime(WaveformView waveform, float fractionCFD, int windowMin, int windowMax) const;
     
     // CFD parameters
     float fTriggerCfdFraction;   // Trigger CFD fraction
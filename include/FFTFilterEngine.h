@@ -0,0 +1,90 @@
+#ifndef HRPPD_FFTFILTERENGINE_H
+#define HRPPD_FFTFILTERENGINE_H
+
+#include <vector>
+#include <string>
+
+
+class TVirtualFFT;
+class TH1D;
+
+namespace HRPPD {
+    // Running sum of |X_k|^2 / N over the waveforms passed through an FFTFilterEngine.
+    // The average is the power spectrum of the unfiltered input (e.g. the noise spectrum of a channel).
+    class PowerSpectrum {
+    public:
+        explicit PowerSpectrum(int size = 1000);
+
+        void Add(const double* re, const double* im);
+        // Same, for a spectrum stored as interleaved (re, im) pairs (fftw_complex layout)
+        void AddInterleaved(const double* reIm);
+        // Add the sums of another spectrum of the same size (e.g. of another event range)
+        void Add(const PowerSpectrum& other);
+        void Reset();
+
+        int GetSize() const { return fSize; }
+        int GetNFrequencies() const { return fSize / 2 + 1; }
+        long GetEntries() const { return fEntries; }
+        std::vector<double> GetAverage() const;
+
+        // Average power in dB per bin below Nyquist, x axis in the units of samplingRate.
+        // The histogram is detached from gDirectory; the caller owns it. Call after the workers are done.
+        TH1D* MakeHistogram(const std::string& name, const std::string& title, float samplingRate) const;
+
+    private:
+        int fSize;
+        std::vector<double> fSum;
+        long fEntries = 0;
+    };
+
+    // Frequency-domain filter with persistent FFTW plans.
+    // The R2C and C2R plans and the transfer function are set up once; Filter() then only
+    // copies the samples, runs the two transforms and applies the weights, with no allocation.
+    // An engine is used by one thread at a time (the plans own their work arrays); engines in
+    // different threads are independent, plan creation and destruction are serialized internally.
+    // FilterBatch() transforms kBatchSize waveforms per call with FFTW many-transform plans
+    // (fftw_plan_many_dft_r2c/c2r); without FFTW (HRPPD_HAVE_FFTW unset) it calls Filter() per waveform.
+    class FFTFilterEngine {
+    public:
+        // Number of transforms in one execution of the batch plans
+        static const int kBatchSize = 256;
+
+        explicit FFTFilterEngine(int size = 1000);
+        ~FFTFilterEngine();
+
+        FFTFilterEngine(const FFTFilterEngine&) = delete;
+        FFTFilterEngine& operator=(const FFTFilterEngine&) = delete;
+
+        bool IsValid() const { return fForward && fBackward; }
+        int GetSize() const { return fSize; }
+        int GetNFrequencies() const { return fSize / 2 + 1; }
+
+        // Weight applied to frequency bin k (0 <= k <= size/2)
+        void SetTransfer(const std::vector<double>& transfer);
+        const std::vector<double>& GetTransfer() const { return fTransfer; }
+
+        // Filter the first GetSize() samples of input into output (input == output is allowed).
+        // The unfiltered spectrum is added to spectrum if given.
+        bool Filter(const float* input, float* output, PowerSpectrum* spectrum = nullptr);
+        // Filter nEvents waveforms stored every stride (>= GetSize()) samples, kBatchSize at a time.
+        // The batch plans and their buffers (about 4 MB for size 1000) are created on the first call.
+        // The output agrees with Filter() up to rounding.
+        bool FilterBatch(const float* input, float* output, int nEvents, int stride, PowerSpectrum* spectrum = nullptr);
+
+    private:
+        struct BatchPlans;
+        bool CreateBatchPlans();
+
+
+        int fSize;
+        TVirtualFFT* fForward = nullptr;   // R2C, owned
+        TVirtualFFT* fBackward = nullptr;  // C2R, owned
+        std::vector<double> fTransfer;     // size/2+1 weights
+        std::vector<double> fSamples;      // Real-space work buffer
+        std::vector<double> fRe;           // Spectrum work buffers
+        std::vector<double> fIm;
+        BatchPlans* fBatch = nullptr;      // Many-transform plans, owned
+    };
+}
+
+#endif // HRPPD_FFTFILTERENGINE_H
@@ -0,0 +1,70 @@
+#ifndef HRPPD_FEATURETREE_H
+#define HRPPD_FEATURETREE_H
+
+#include <string>
+#include <memory>
+
+
+class TFile;
+class TTree;
+
+namespace HRPPD {
+    // Per-event quantities of one MCP channel: one row of the feature tree.
+    // Quantities the analyzer only computes for signal events are 0 for the others; the ToT is
+    // stored for every row, so the selection can be redone on amp, rms and tot.
+    struct EventFeatures {
+        int eventNum = 0;
+        int channel = 0;
+        bool isSignal = false;
+        float pedestal = 0.;        // Mean of the first 128 raw samples
+        float rms = 0.;             // Baseline RMS (of the filtered waveform when the filter is applied)
+        float amp = 0.;             // |minimum| in the MCP window (mV)
+        float threshold = 0.;       // Signal threshold, 4 * rms (Rehistogram: rehist_threshold * rms)
+        float tot = 0.;             // Time over threshold (ps)
+        float triggerTime = 0.;     // Trigger CFD time (ps)
+        float mcpTime = 0.;         // MCP CFD time (ps)
+        float npe = 0.;
+        int nAfterpulses = 0;       // Pulses found by AfterpulseFinder
+    };
+
+    // Writes EventFeatures rows, one branch per quantity, to the "Features" tree of its own file.
+    // The rows are small, so rebinning or recutting the analysis from them takes seconds.
+    class FeatureWriter {
+    public:
+        FeatureWriter();
+        ~FeatureWriter();
+
+        bool Open(const std::string& fileName);
+        void Fill(const EventFeatures& features);
+        // Write the tree and close the file
+        void Close();
+        bool IsOpen() const { return fTree != nullptr; }
+
+    private:
+        std::unique_ptr<TFile> fFile;
+        TTree* fTree = nullptr;     // Owned by fFile
+        EventFeatures fRow;
+    };
+
+    // Reads the rows written by FeatureWriter
+    class FeatureReader {
+    public:
+        FeatureReader();
+        ~FeatureReader();
+
+        bool Open(const std::string& fileName);
+        long long GetEntries() const;
+        // Row of the given entry; valid until the next call
+        const EventFeatures& GetEntry(long long entry);
+        void Close();
+
+    private:
+        std::unique_ptr<TFile> fFile;
+        TTree* fTree = nullptr;     // Owned by fFile
+        EventFeatures fRow;
+    };
+
+    static const char* const kFeatureTreeName = "Features";
+}
+
+#endif // HRPPD_FEATURETREE_H
@@ -0,0 +1,44 @@
+#ifndef HRPPD_IIRFILTER_H
+#define HRPPD_IIRFILTER_H
+
+
+namespace HRPPD {
+    // Order-8 Butterworth low-pass as a cascade of 4 biquads (bilinear transform, prewarped cutoff),
+    // run forward and backward for zero phase. The forward-backward magnitude response is
+    // 1/(1+(f/fc)^16), the weight FFTFilter applies through WaveformProcessor::LowPassFilter.
+    // Coefficients are fixed by SetLowPass; filtering keeps its state on the stack, so a
+    // configured filter can be shared between threads.
+    class IIRFilter {
+    public:
+        static const int kOrder = 8;
+        static const int kSections = kOrder / 2;
+
+        IIRFilter() = default;
+        IIRFilter(float cutoffFrequency, float samplingRate) { SetLowPass(cutoffFrequency, samplingRate); }
+
+        void SetLowPass(float cutoffFrequency, float samplingRate);
+        bool IsValid() const { return fValid; }
+
+        // Zero-phase filtering of n samples (input == output is allowed)
+        void Filter(const float* input, float* output, int n) const;
+        // nEvents waveforms stored every stride (>= n) samples, first n samples of each;
+        // on an AVX2 CPU, 8 waveforms are filtered side by side in the vector lanes.
+        // Returns false (nothing filtered) if the filter is invalid or stride < n.
+        bool FilterBatch(const float* input, float* output, int nEvents, int stride, int n) const;
+
+    private:
+        // Transposed direct form II section, a0 = 1
+        struct Biquad {
+            float b0 = 1.;
+            float b1 = 0.;
+            float b2 = 0.;
+            float a1 = 0.;
+            float a2 = 0.;
+        };
+
+        Biquad fSections[kSections];
+        bool fValid = false;
+    };
+}
+
+#endif // HRPPD_IIRFILTER_H
@@ -8,8 +8,15 @@
 
 
 namespace HRPPD {
+    class RawReader;
+    
     class Ntupler {
     public:
+        // MCPTree layout written by Convert, stored as "schemaVersion" in the tree UserInfo
+        //   1: std::vector<float> waveform branches (files without UserInfo)
+        //   2: fixed-size float[1024] leaf-list branches
+        static const int kSchemaVersion = 2;
+        
         Ntupler();
         ~Ntupler();
 
@@ -21,10 +28,31 @@ namespace HRPPD {
         // Utility functions
         static bool Check(int runNumber, const std::string& ntuplePath = "");
         static std::string GetPath(int runNumber, const std::string& ntuplePath = "");
+        static std::string GetRunDir(int runNumber, const std::string& rawDataPath = "");
+        
+        // Number of threads compressing branches in parallel (<= 1: serial)
+        void SetThreads(int nThreads) { fThreads = nThreads; }
+        
+        // Output format: "ttree" (MCPTree TTree) or "rntuple" (MCPTree RNTuple)
+        void SetFormat(const std::string& format) { fFormat = format; }
+        
+        // MCP channels to write; channels whose wave_N.dat is missing are omitted
+        void SetChannels(const std::vector<int>& channels) { fChannels = channels; }
         
     private:
+        // Per-format writers; return the number of raw bytes consumed, or -1 on failure
+        double WriteTTree(const std::string& outputFileName, const RawReader& trigReader, 
+                          const std::vector<RawReader>& chReaders, 
+                          const std::vector<int>& channels, int numEvents);
+        double WriteRNTuple(const std::string& outputFileName, const RawReader& trigReader, 
+                            const std::vector<RawReader>& chReaders, 
+                            const std::vector<int>& channels, int numEvents);
+        
         std::string fRawDataPath;  // Path where .dat files are located
         std::string fNtuplePath;    // Path to save ntuple files
+        int fThreads;               // Implicit MT pool size used by Convert
+        std::string fFormat;        // Output format written by Convert
+        std::vector<int> fChannels; // MCP channels requested for conversion
     };
 }
 
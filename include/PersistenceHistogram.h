@@ -0,0 +1,59 @@
+#ifndef HRPPD_PERSISTENCEHISTOGRAM_H
+#define HRPPD_PERSISTENCEHISTOGRAM_H
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+
+class TH2F;
+
+namespace HRPPD {
+    // Waveform persistence plot (time vs amplitude counts) accumulated in 16-bit counters.
+    // Time bin i is sample i, so only the amplitude bin is computed, for a whole waveform at
+    // once. A counter that wraps past 65535 carries into a sparse 64-bit table, so the counts
+    // stay exact at half the memory of a TH2F. Amplitudes outside the axis go to underflow and
+    // overflow rows, as in TH2F::Fill.
+    //
+    // Not thread safe: give each thread its own instance and combine them with Add().
+    class PersistenceHistogram {
+    public:
+        // Time axis of nTimeBins bins, one per sample; amplitude axis as in TH2F
+        PersistenceHistogram(int nTimeBins, double timeMin, double timeMax,
+                             int nAmpBins, double ampMin, double ampMax);
+
+        // Add one waveform; samples past nTimeBins are ignored
+        void Fill(const float* samples, int nSamples);
+
+        // Add the counts of other (same binning)
+        bool Add(const PersistenceHistogram& other);
+
+        // Count of time bin [0, nTimeBins) and amplitude bin [0, nAmpBins + 1] (0: underflow, nAmpBins + 1: overflow)
+        uint64_t GetCount(int timeBin, int ampBin) const;
+        long long GetEntries() const { return fEntries; }
+
+        // New TH2F with the counts (amplitude underflow and overflow included) and statistics
+        // computed from the bins, not attached to any directory
+        TH2F* MakeHistogram(const char* name, const char* title) const;
+
+    private:
+        size_t Index(int timeBin, int ampBin) const { return (size_t)timeBin * (fNAmpBins + 2) + ampBin; }
+
+        int fNTimeBins;
+        double fTimeMin;
+        double fTimeMax;
+        int fNAmpBins;
+        double fAmpMin;
+        double fAmpMax;
+        float fScale;               // Amplitude bins per mV
+        float fOffset;              // Amplitude bin coordinate of 0 mV
+
+        std::vector<uint16_t> fCounts;                  // [timeBin][ampBin], low 16 bits
+        std::unordered_map<size_t, uint64_t> fCarry;    // Wrapped counts (multiples of 65536) by index
+        std::vector<int> fBins;                         // Scratch: amplitude bin of each sample
+        long long fEntries = 0;                         // Filled samples, as TH2F counts them
+    };
+}
+
+#endif // HRPPD_PERSISTENCEHISTOGRAM_H
@@ -0,0 +1,47 @@
+#ifndef HRPPD_PROVENANCE_H
+#define HRPPD_PROVENANCE_H
+
+#include <string>
+#include <vector>
+
+
+namespace HRPPD {
+    struct AnalysisOptions;
+
+    // What an output file was made from, as "key value" lines: the analyzer's arguments, the
+    // effective configuration, the input files and the library version. It is stored in the
+    // output as the TNamed "Provenance" (the text is its title), so the analyzer can tell
+    // whether an existing output is still current.
+    class Provenance {
+    public:
+        void Add(const std::string& key, const std::string& value);
+        // Size and modification time of a file, or "missing". Checksumming a multi-GB ntuple
+        // would cost as much as analysing it, and a rewritten ntuple changes both.
+        void AddFile(const std::string& key, const std::string& path);
+        // "<path> size <bytes> mtime <seconds>", or "<path> missing", as recorded by AddFile
+        static std::string DescribeFile(const std::string& path);
+        const std::string& GetText() const { return fText; }
+
+        // Provenance text stored in a ROOT file, "" if the file or the object is missing
+        static std::string Read(const std::string& fileName);
+        // Lines of one text missing from the other, prefixed "- " (old) and "+ " (new), at most maxLines
+        static std::string Diff(const std::string& oldText, const std::string& newText, int maxLines = 5);
+
+        // Version of the library the analysis ran with (git description when it was built, with a
+        // hash of the uncommitted changes if the tree was dirty)
+        static const char* GetLibraryVersion();
+
+        // Everything the Analysis output of a run depends on (source "ntuple" or "raw"), shared by the
+        // analyzer and the batch driver so either recognises the other's outputs. The thread count
+        // and scheduling do not change the output and are left out.
+        static Provenance ForRun(int runNumber, const std::vector<int>& channels, int maxEvents,
+                                 const AnalysisOptions& analysis, const std::string& source);
+
+    private:
+        std::string fText;
+    };
+
+    static const char* const kProvenanceName = "Provenance";
+}
+
+#endif // HRPPD_PROVENANCE_H
@@ -0,0 +1,45 @@
+#ifndef HRPPD_RAWREADER_H
+#define HRPPD_RAWREADER_H
+
+#include <string>
+#include <cstddef>
+
+
+namespace HRPPD {
+    // Read-only, memory-mapped view of a raw DRS4 .dat file (TR_0_0.dat, wave_N.dat).
+    // Each event is kSamplesPerEvent consecutive 4-byte floats; GetEvent() returns a
+    // pointer into the mapping, valid until Close() or destruction. No data is copied.
+    class RawReader {
+    public:
+        static const int kSamplesPerEvent = 1024;
+        static const size_t kEventSize = kSamplesPerEvent * sizeof(float);
+
+        RawReader();
+        explicit RawReader(const std::string& fileName);
+        ~RawReader();
+
+        RawReader(const RawReader&) = delete;
+        RawReader& operator=(const RawReader&) = delete;
+        RawReader(RawReader&& other) noexcept;
+        RawReader& operator=(RawReader&& other) noexcept;
+
+        // File management
+        bool Open(const std::string& fileName);
+        void Close();
+        bool IsOpen() const { return fData != nullptr; }
+
+        // Event data access
+        int GetEntries() const { return fEntries; }
+        const float* GetEvent(int eventIndex) const;
+        size_t GetSize() const { return fSize; }
+        const std::string& GetName() const { return fFileName; }
+
+    private:
+        std::string fFileName;
+        const char* fData = nullptr;  // Start of the mapping
+        size_t fSize = 0;             // Mapped size in bytes
+        int fEntries = 0;
+    };
+}
+
+#endif // HRPPD_RAWREADER_H
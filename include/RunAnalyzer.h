@@ -0,0 +1,154 @@
+#ifndef HRPPD_RUNANALYZER_H
+#define HRPPD_RUNANALYZER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include "WaveformView.h"
+
+
+namespace HRPPD {
+    class DataIO;
+    class FeatureWriter;
+    class SnapshotWriter;
+    class SignalIndex;
+    struct EventFeatures;
+
+    // Analyses run on the signal events of each channel, and the event loop threads
+    struct AnalysisOptions {
+        bool doWaveform = false;
+        bool doWaveform2D = false;
+        bool doToT = false;
+        bool doTiming = false;
+        bool doAmplitude = false;
+        bool doNpe = false;
+        bool doAfterpulse = false;  // Afterpulse counts, ratio, multiplicity and delays (AfterpulseFinder)
+        int threads = 1;            // Event loop threads, and workers of the run (<= 1: serial)
+        bool pipeline = false;      // Reader thread -> threads compute threads -> writer
+        bool preselect = false;     // Reject non-signal waveforms before the full correction (same output)
+        int maxSnapshots = -1;      // Waveform snapshots stored per channel (doWaveform, -1: every signal event)
+        std::string featureFile;    // Per-event feature tree of every event and channel ("": not written)
+        std::string signalIndexFile; // Cache of the signal entries of each channel (SignalIndex, "": none)
+        bool printProgress = true;  // "Processing event" lines (the batch driver reports for all runs instead)
+    };
+
+    // Event loop of the analyzer: correction, signal selection and the ToT, timing, amplitude,
+    // Npe and afterpulse histograms of one run, for every MCP channel loaded in the DataIO.
+    //
+    // Each event is read once. Its trigger waveform is corrected once and its CFD time computed
+    // once, then every channel runs its own chain on its MCP waveform. A single channel writes
+    // its results to the top level of the output file; several channels write to Ch<N>/.
+    //
+    // The entries are split into TTree-cluster-aligned chunks (DataIO::GetClusterRanges) that
+    // threads of a WorkStealingPool analyse with ProcessChunk(int), as the batch driver does.
+    // Each worker has its own DataIO, WaveformProcessor and EventAnalyzer. The histogram fills of
+    // a chunk are kept per event and replayed in entry order, under a mutex, by the thread that
+    // completes the next chunk, so every thread count (including 1) writes the same histograms.
+    //
+    // In pipeline mode a reader thread decodes batches of entries into a ring of reusable
+    // buffers, a pool of compute threads analyses them and the calling thread writes the results.
+    // The stages are joined by bounded lock-free queues (BoundedQueue); a full queue or an
+    // empty buffer ring stalls the upstream stage. Each stage reports its utilization.
+    // Batch boundaries are the same as in the chunked loop, and so is the output.
+    //
+    // With AnalysisOptions::featureFile set, the features of every event and channel (signal or
+    // not) are also written to a FeatureTree file, from which Rehistogram() rebuilds the
+    // histograms with a tighter amplitude or ToT selection without another pass over the
+    // waveforms. The binning is that of the waveform pass.
+    //
+    // With AnalysisOptions::signalIndexFile set, a full pass that reads every entry stores the
+    // signal entries of each channel under a hash of the input files and the selection parameters. A later pass with the same selection
+    // that needs no other events (no feature tree, no filter spectrum) reads only those entries,
+    // and skips the clusters that hold none of them.
+    class RunAnalyzer {
+    public:
+        explicit RunAnalyzer(const AnalysisOptions& options);
+        ~RunAnalyzer();
+
+        // Analyse the first maxEvents (-1: all) entries of the input loaded in dataIO, for all of
+        // its channels, and write the results to its output file. Analysis parameters are taken
+        // from the CONFIG_ globals.
+        bool Run(DataIO& dataIO, int runNumber, int maxEvents = -1);
+
+        // Run() in steps, for a scheduler that interleaves the chunks of several runs (analysis/batch.cc).
+        // Begin() sets up the outputs and splits the entries into GetNChunks() chunks. ProcessChunk()
+        // is then called once per chunk, from any threads and in any order: it analyses the chunk with
+        // an idle one of the AnalysisOptions::threads workers (waiting while all are busy) and writes
+        // the completed chunks in entry order, so the output is that of Run(). It returns true once the last chunk is written, after
+        // which Finish() writes the run's results. Call ROOT::EnableThreadSafety() first. Finish() draws
+        // canvases and sets gStyle, so Finish() of several runs must not overlap (batch.cc serializes it).
+        bool Begin(DataIO& dataIO, int runNumber, int maxEvents = -1);
+        int GetNChunks() const { return fRanges.size(); }
+        bool ProcessChunk(int chunk);
+        bool Finish();
+        // Entries analysed so far (for progress reports, from any thread)
+        long long GetAnalysedEntries() const { return fAnalysedEntries; }
+        int GetProcessEvents() const { return fProcessEvents; }
+
+        // Rebuild the ToT, timing, amplitude, Npe and afterpulse count histograms of the given channels from a feature
+        // tree written by Run(), into the output file of dataIO (no input needs to be loaded), for the
+        // rows passing CONFIG_REHIST_THRESHOLD and CONFIG_REHIST_MIN_TOT. With the defaults (the cut of
+        // Run()) the fills are the ones Run() makes, so the histograms are identical.
+        bool Rehistogram(DataIO& dataIO, const std::vector<int>& channels, const std::string& featureFile);
+
+    private:
+        struct EventRecord;
+        struct WaveformDump;
+        struct ChunkResult;
+        struct ChannelOutput;
+        struct Worker;
+
+        bool RunPipeline(DataIO& dataIO, std::vector<std::unique_ptr<Worker>>& workers,
+                         const std::vector<std::pair<int, int>>& ranges);
+        // New worker for the input of fDataIO (none opened when openInput is false), nullptr on failure
+        Worker* AddWorker(bool openInput);
+        void ProcessChunk(Worker& worker, ChunkResult& result) const;
+        // Entries of [first, last) to analyse: all of them, or the signal index entries
+        void ChunkEntries(int first, int last, std::vector<int>& entries) const;
+        // Correct one event (the trigger and the MCP waveforms in worker.mcpWaves) into a batch slot of the worker
+        void CorrectEvent(Worker& worker, int slot, int eventNum, WaveformView trigWave) const;
+        // Filter and analyse the first nBatch slots of the worker's batch
+        void AnalyzeBatch(Worker& worker, int nBatch, ChunkResult& result) const;
+        void MergeChunk(DataIO& dataIO, ChunkResult& result);
+        // Rejected fractions and time saved by the preselection, summed over the workers
+        void PrintPreselection(const std::vector<std::unique_ptr<Worker>>& workers) const;
+        void MergeWorker(Worker& worker);
+        void FillHistograms(ChannelOutput& output, const EventFeatures& features);
+        // Print the afterpulse counts and ratio of a channel and store them as TParameters
+        void WriteAfterpulseSummary(DataIO& dataIO, const ChannelOutput& output) const;
+        void CreateHistograms(DataIO& dataIO, ChannelOutput& output);
+
+        AnalysisOptions fOptions;
+        int fRunNumber = 0;
+        int fProcessEvents = 0;
+
+        // Output histograms, CFD samples and spectrum of each channel, in DataIO::GetChannels() order
+        std::vector<std::unique_ptr<ChannelOutput>> fOutputs;
+        std::unique_ptr<FeatureWriter> fFeatureWriter;
+        std::unique_ptr<SnapshotWriter> fSnapshotWriter;    // Tree owned by the output file
+        std::unique_ptr<SignalIndex> fSignalIndex;          // Signal entries recorded by a full pass
+        bool fUseIndex = false;                             // Only fIndexEntries are read
+        std::vector<int> fIndexEntries;
+        std::vector<std::string> fSelectionKeys;            // Signal index keys, per channel
+
+        // Event loop state between Begin() and Finish()
+        DataIO* fDataIO = nullptr;
+        std::chrono::steady_clock::time_point fStart;
+        std::vector<std::pair<int, int>> fRanges;           // Entry range of each chunk
+        std::vector<ChunkResult> fResults;
+        std::vector<std::unique_ptr<Worker>> fWorkers;
+        std::vector<Worker*> fIdleWorkers;
+        std::mutex fWorkerMutex;
+        std::condition_variable fWorkerFree;                // Signalled when a worker becomes idle
+        std::mutex fMergeMutex;
+        size_t fNextMerge = 0;                              // First chunk not yet written
+        std::atomic<long long> fAnalysedEntries{0};
+        long long fUnreadEntries = 0;                       // Entries GetEvent skipped, summed by MergeChunk
+    };
+}
+
+#endif // HRPPD_RUNANALYZER_H
@@ -0,0 +1,44 @@
+#ifndef HRPPD_SIGNALINDEX_H
+#define HRPPD_SIGNALINDEX_H
+
+#include <string>
+#include <vector>
+
+
+namespace HRPPD {
+    // Entry numbers of the signal events of each channel of a run, cached between analyzer
+    // passes. Each channel's entries are stored as a TEntryList named Signal_ch<N>_<hash>, where
+    // the hash is that of the selection key: a text of every parameter the selection depends on,
+    // which is also the list's title. Lists of other selections stay in the file, so switching
+    // back to earlier settings finds them again. The lists name "MCPTree", so macros can use them
+    // with TTree::SetEntryList.
+    class SignalIndex {
+    public:
+        // Empty index of nChannels channels
+        void Reset(int nChannels);
+
+        // Read the list of every channel for its selection key (keys[i] for channels[i]);
+        // false if the file or any of the lists is missing
+        bool Load(const std::string& fileName, const std::vector<int>& channels, const std::vector<std::string>& keys);
+
+        // Write the lists to fileName, replacing those of the same selections
+        bool Save(const std::string& fileName, const std::vector<int>& channels, const std::vector<std::string>& keys) const;
+
+        // Delete the lists of these selections from fileName (true if none is left)
+        static bool Remove(const std::string& fileName, const std::vector<int>& channels, const std::vector<std::string>& keys);
+
+        // Entries must be added in increasing order
+        void Add(int channelIndex, int entry) { fEntries[channelIndex].push_back(entry); }
+        const std::vector<int>& GetEntries(int channelIndex) const { return fEntries[channelIndex]; }
+        // Entries that are signal in at least one channel, in increasing order
+        std::vector<int> GetUnion() const;
+
+        // TEntryList name of a channel's selection
+        static std::string ListName(int channel, const std::string& key);
+
+    private:
+        std::vector<std::vector<int>> fEntries;    // [channel index] signal entries
+    };
+}
+
+#endif // HRPPD_SIGNALINDEX_H
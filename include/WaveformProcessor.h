@@ -1,8 +1,13 @@
 #ifndef WAVEFORM_PROCESSOR_H
 #define WAVEFORM_PROCESSOR_H
 
+#include "WaveformView.h"
+#include "IIRFilter.h"
+
 #include <vector>
 #include <string>
+#include <memory>
+#include <cmath>
 #include <TH1F.h>
 #include <TDirectory.h>
 #include <TSpline.h>
@@ -12,30 +17,89 @@
 
 namespace HRPPD {
 
+class FFTFilterEngine;
+class PowerSpectrum;
+
+// Baseline statistics and window minimum gathered while correcting a waveform
+struct WaveformStats {
+    float pedestal = 0.;  // Mean of the first 128 raw samples
+    float rms = 0.;       // RMS of the first 128 corrected samples (same as GetStdDev)
+    float min = 0.;       // Minimum corrected sample in [windowMin, windowMax)
+    int minIndex = -1;    // Index of the first minimum sample, -1 for an empty window
+
+    // Signal amplitude |min| in mV, as EventAnalyzer::GetAmp. The original analyzer took the
+    // integer abs() of the minimum, truncating amplitudes to whole mV; they are kept as floats
+    // since, which changes the Amplitude and ToT fills and the 4 sigma selection near threshold.
+    float Amplitude() const { return std::abs(min); }
+};
+
+// Thread safety: an instance holds no global state. The const methods only read the public
+// parameters and may be called concurrently on one instance. The filter methods cache FFT
+// plans and filter coefficients in the instance, so each worker thread needs its own
+// WaveformProcessor (FFT plan creation itself is serialized in FFTFilterEngine).
+// The constructor reads the CONFIG_* values, so load the configuration before starting workers.
 class WaveformProcessor {
 public:
     WaveformProcessor();
     ~WaveformProcessor();
     
     // Waveform processing functions
-    std::vector<float> Correct(const std::vector<float>& waveform);
+    // (all take a WaveformView; std::vector<float> arguments convert implicitly)
+    std::vector<float> Correct(WaveformView waveform) const;
+    // Allocation-free Correct: writes waveform.size() samples to output and returns the
+    // baseline statistics and the minimum in [windowMin, windowMax) from the same pass
+    WaveformStats Correct(WaveformView waveform, float* output, int windowMin, int windowMax) const;
+    // Partial Correct for preselection: writes only the first 128 samples and [windowMin, windowMax)
+    // of output, which are all the statistics and ToT depend on; both match the full Correct exactly
+    WaveformStats CorrectWindow(WaveformView waveform, float* output, int windowMin, int windowMax) const;
     // float GetStdDev(const std::vector<float>& waveform, int start = 0, int end = -1);
-    float GetStdDev(const std::vector<float>& waveform);
-    std::vector<float> FFTFilter(const std::vector<float>& waveform, 
+    float GetStdDev(WaveformView waveform) const;
+    std::vector<float> FFTFilter(WaveformView waveform, 
                                float cutoffFrequency, 
                                int eventNumber, int channelNumber);
-    bool ToTCut(const std::vector<float>& waveform, int windowMin, int windowMax);
+    // Buffer version: filters the first kFFTSize samples of input into output (may be the same buffer)
+    // with the persistent plans; the unfiltered power spectrum is added to spectrum if given
+    bool FFTFilter(const float* input, float* output, float cutoffFrequency, PowerSpectrum* spectrum = nullptr);
+    // Low-pass filter of the first kFFTSize samples with the implementation chosen by fFilterMode:
+    // "fft" (FFTFilter) or "iir" (zero-phase biquad cascade, no spectrum)
+    bool FilterWaveform(const float* input, float* output, float cutoffFrequency);
+    // nEvents waveforms stored every stride (>= kFFTSize) samples. "iir" filters 8 waveforms at a
+    // time in the AVX2 lanes; "fft" runs FFTFilterEngine::FilterBatch (FFTW many-transform plans)
+    bool FilterBatch(const float* input, float* output, int nEvents, int stride, 
+                     float cutoffFrequency, PowerSpectrum* spectrum = nullptr);
+    // ToT functions take the baseline RMS from WaveformStats when available (negative: compute it)
+    bool ToTCut(WaveformView waveform, int windowMin, int windowMax, float stdDev = -1.) const;
     
     // Internal utility functions
-    float GetOverShoot(const std::vector<float>& waveform, int windowMin, int windowMax);
-    float GetToT(const std::vector<float>& waveform, int windowMin, int windowMax);
-    int GetToTBin(const std::vector<float>& waveform, int windowMin, int windowMax);
-    float LowPassFilter(float cutoffFrequency, int order, float inputFreq);
+    float GetOverShoot(WaveformView waveform, int windowMin, int windowMax) const;
+    float GetToT(WaveformView waveform, int windowMin, int windowMax, float stdDev = -1.) const;
+    int GetToTBin(WaveformView waveform, int windowMin, int windowMax, float stdDev = -1.) const;
+    float LowPassFilter(float cutoffFrequency, int order, float inputFreq) const;
+    
+    // Number of samples handled by the FFT filter
+    static const int kFFTSize = 1000;
     
     // Public member variables - directly accessible
     float fCalibrationConstant;  // Calibration constant
     float fDeltaT;               // Sampling interval (seconds)
     float fSamplingRate;         // Sampling rate (Hz)
+    std::string fFilterMode;     // Low-pass filter implementation: fft | iir
+
+private:
+    // RMS of the first 128 corrected samples, as GetStdDev
+    static float BaselineRMS(const float* corrected);
+
+    // FFT plans and Butterworth weights, rebuilt only when the cutoff or sampling rate changes
+    FFTFilterEngine* GetFFTEngine(float cutoffFrequency);
+    std::unique_ptr<FFTFilterEngine> fFFTEngine;
+    float fFFTCutoffFrequency = -1.;
+    float fFFTSamplingRate = -1.;
+    
+    // IIR coefficients, likewise recomputed only when the cutoff or sampling rate changes
+    const IIRFilter& GetIIRFilter(float cutoffFrequency);
+    IIRFilter fIIRFilter;
+    float fIIRCutoffFrequency = -1.;
+    float fIIRSamplingRate = -1.;
 };
 
 } // namespace HRPPD
@@ -0,0 +1,146 @@
+#ifndef HRPPD_WAVEFORMSNAPSHOT_H
+#define HRPPD_WAVEFORMSNAPSHOT_H
+
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <iostream>
+#include "TFile.h"
+#include "TTree.h"
+#include "TDirectory.h"
+#include "TString.h"
+
+
+// Corrected waveforms of signal events, stored by the analyzer (doWaveform) as rows of the
+// "Waveforms" tree of Analysis_Run_<N>.root instead of one histogram per event.
+// Header-only, so ROOT macros can include it without loading the library:
+//
+//     #include "../../include/WaveformSnapshot.h"
+//     HRPPD::SnapshotReader reader;
+//     reader.Open("Analysis_Run_123.root", false);     // MCP samples only
+//     while (reader.Next()) {
+//         const HRPPD::WaveformSnapshot& row = reader.Get();
+//         if (row.channel == 10) ... row.mcp[i] ...    // sample i = bin i+1 of the former histograms
+//     }
+namespace HRPPD {
+    struct WaveformSnapshot {
+        static const int kSamples = 1000;   // 200 ns at 200 ps per sample
+        int eventNum = 0;
+        int channel = 0;
+        float trig[kSamples];               // Corrected trigger waveform (mV)
+        float mcp[kSamples];                // Corrected (and filtered) MCP waveform (mV)
+    };
+
+    static const char* const kSnapshotTreeName = "Waveforms";
+
+    // Fills the snapshot tree in a directory of an output file, which owns it and writes it
+    // when the file is written. Not thread safe: fill from the thread that owns the file.
+    class SnapshotWriter {
+    public:
+        SnapshotWriter(TDirectory* dir, const std::string& title) {
+            TDirectory::TContext context(dir);
+            fTree = new TTree(kSnapshotTreeName, title.c_str());
+            fTree->Branch("eventNum", &fRow.eventNum, "eventNum/I");
+            fTree->Branch("channel", &fRow.channel, "channel/I");
+            fTree->Branch("trig", fRow.trig, Form("trig[%d]/F", WaveformSnapshot::kSamples));
+            fTree->Branch("mcp", fRow.mcp, Form("mcp[%d]/F", WaveformSnapshot::kSamples));
+        }
+
+        SnapshotWriter(const SnapshotWriter&) = delete;
+        SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+        // Store the first kSamples samples of each waveform (missing samples are 0)
+        void Fill(int eventNum, int channel, const float* trig, int trigSize, const float* mcp, int mcpSize) {
+            fRow.eventNum = eventNum;
+            fRow.channel = channel;
+            CopySamples(trig, trigSize, fRow.trig);
+            CopySamples(mcp, mcpSize, fRow.mcp);
+            fTree->Fill();
+        }
+
+        long long GetEntries() const { return fTree->GetEntries(); }
+
+    private:
+        static void CopySamples(const float* src, int size, float* dest) {
+            int n = std::min(std::max(size, 0), (int)WaveformSnapshot::kSamples);
+            std::copy(src, src + n, dest);
+            std::fill(dest + n, dest + WaveformSnapshot::kSamples, 0.f);
+        }
+
+        TTree* fTree = nullptr;     // Owned by the directory
+        WaveformSnapshot fRow;
+    };
+
+    // Reads the snapshot rows of an analysis output file in storage order, through a
+    // TTreeCache that prefetches whole clusters of the read branches
+    class SnapshotReader {
+    public:
+        SnapshotReader() = default;
+        ~SnapshotReader() { Close(); }
+
+        SnapshotReader(const SnapshotReader&) = delete;
+        SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+        // readTrigger = false skips (and does not decompress) the trigger samples
+        bool Open(const std::string& fileName, bool readTrigger = true) {
+            Close();
+
+            TDirectory::TContext context;
+            fFile.reset(TFile::Open(fileName.c_str(), "READ"));
+            if (!fFile || fFile->IsZombie()) {
+                std::cerr << "Error: Failed to open " << fileName << std::endl;
+                fFile.reset();
+                return false;
+            }
+            fTree = fFile->Get<TTree>(kSnapshotTreeName);
+            if (!fTree) {
+                std::cerr << "Error: No " << kSnapshotTreeName << " tree in " << fileName << std::endl;
+                Close();
+                return false;
+            }
+
+            fTree->SetBranchStatus("trig", readTrigger);
+            fTree->SetBranchAddress("eventNum", &fRow.eventNum);
+            fTree->SetBranchAddress("channel", &fRow.channel);
+            fTree->SetBranchAddress("mcp", fRow.mcp);
+            if (readTrigger) {
+                fTree->SetBranchAddress("trig", fRow.trig);
+            } else {
+                std::fill(fRow.trig, fRow.trig + WaveformSnapshot::kSamples, 0.f);
+            }
+            fTree->SetCacheSize(64 * 1024 * 1024);
+            fTree->AddBranchToCache("*", true);
+            fTree->StopCacheLearningPhase();
+            fEntry = -1;
+            return true;
+        }
+
+        long long GetEntries() const { return fTree ? fTree->GetEntries() : 0; }
+
+        // Advance to the next row; false after the last one
+        bool Next() {
+            if (!fTree || fEntry + 1 >= fTree->GetEntries()) return false;
+            fTree->GetEntry(++fEntry);
+            return true;
+        }
+
+        // Current row, valid until the next call to Next()
+        const WaveformSnapshot& Get() const { return fRow; }
+
+        void Close() {
+            if (fFile) {
+                fFile->Close();
+            }
+            fFile.reset();
+            fTree = nullptr;
+        }
+
+    private:
+        std::unique_ptr<TFile> fFile;
+        TTree* fTree = nullptr;     // Owned by fFile
+        long long fEntry = -1;
+        WaveformSnapshot fRow;
+    };
+}
+
+#endif // HRPPD_WAVEFORMSNAPSHOT_H
@@ -0,0 +1,41 @@
+#ifndef HRPPD_WAVEFORMVIEW_H
+#define HRPPD_WAVEFORMVIEW_H
+
+#include <vector>
+#include <cstddef>
+#include <stdexcept>
+
+
+namespace HRPPD {
+    // Waveform selector for DataIO::GetWaveformView
+    enum class WaveformType { kTrigger, kMcp };
+
+    // Non-owning, read-only view of waveform samples (span-like).
+    // Views returned by DataIO point into its read buffers and stay valid until the next GetEvent.
+    // A std::vector<float> converts implicitly, so every function taking a view also accepts vectors.
+    class WaveformView {
+    public:
+        WaveformView() = default;
+        WaveformView(const float* data, size_t size) : fData(data), fSize(size) {}
+        WaveformView(const std::vector<float>& waveform) : fData(waveform.data()), fSize(waveform.size()) {}
+
+        const float* data() const { return fData; }
+        size_t size() const { return fSize; }
+        bool empty() const { return fSize == 0; }
+
+        const float* begin() const { return fData; }
+        const float* end() const { return fData + fSize; }
+
+        const float& operator[](size_t i) const { return fData[i]; }
+        const float& at(size_t i) const {
+            if (i >= fSize) throw std::out_of_range("WaveformView::at");
+            return fData[i];
+        }
+
+    private:
+        const float* fData = nullptr;
+        size_t fSize = 0;
+    };
+}
+
+#endif // HRPPD_WAVEFORMVIEW_H
@@ -0,0 +1,148 @@
+#ifndef HRPPD_WORKSTEALINGPOOL_H
+#define HRPPD_WORKSTEALINGPOOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace HRPPD {
+    // Thread pool with a task deque per thread. Tasks submitted by a pool thread go to its own
+    // deque and are run newest first, while their data is still in cache; a thread with none
+    // steals the oldest task of another thread. Tasks submitted from outside the pool wait in a
+    // shared queue that is only served when no task can be stolen. Submitting runs from outside
+    // and their chunks from inside therefore spreads each run over every idle thread before the
+    // next one is started, so few runs are in memory at a time and short and long runs balance.
+    //
+    // Each deque has its own mutex; tasks are coarse (a chunk of entries), so contention is low.
+    class WorkStealingPool {
+    public:
+        explicit WorkStealingPool(int nThreads) {
+            for (int i = 0; i < nThreads; i++) {
+                fQueues.emplace_back(new Queue());
+            }
+            for (int i = 0; i < nThreads; i++) {
+                fThreads.emplace_back([this, i] { Loop(i); });
+            }
+        }
+
+        ~WorkStealingPool() {
+            Wait();
+            {
+                std::lock_guard<std::mutex> lock(fMutex);
+                fStop = true;
+            }
+            fWake.notify_all();
+            for (std::thread& thread : fThreads) {
+                thread.join();
+            }
+        }
+
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+        int GetNThreads() const { return fThreads.size(); }
+
+        void Submit(std::function<void()> task) {
+            // Counted as pending before it can be taken, so Wait() cannot see zero while it runs
+            {
+                std::lock_guard<std::mutex> lock(fMutex);
+                fPending++;
+            }
+            if (tPool == this) {
+                Queue& queue = *fQueues[tIndex];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back(std::move(task));
+            }
+            {
+                std::lock_guard<std::mutex> lock(fMutex);
+                if (tPool != this) {
+                    fShared.push_back(std::move(task));
+                }
+                fQueued++;
+            }
+            fWake.notify_one();
+        }
+
+        // Block until every submitted task, and every task they submitted, has run
+        void Wait() {
+            std::unique_lock<std::mutex> lock(fMutex);
+            fIdle.wait(lock, [this] { return fPending == 0; });
+        }
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        // Own deque (newest), then the other deques (oldest), then the shared queue
+        bool Take(int index, std::function<void()>& task) {
+            for (size_t i = 0; i < fQueues.size(); i++) {
+                Queue& queue = *fQueues[(index + i) % fQueues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty()) continue;
+                if (i == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                std::lock_guard<std::mutex> sharedLock(fMutex);
+                fQueued--;
+                return true;
+            }
+            std::lock_guard<std::mutex> lock(fMutex);
+            if (fShared.empty()) return false;
+            task = std::move(fShared.front());
+            fShared.pop_front();
+            fQueued--;
+            return true;
+        }
+
+        void Loop(int index) {
+            tPool = this;
+            tIndex = index;
+            for (;;) {
+                std::function<void()> task;
+                if (Take(index, task)) {
+                    task();
+                    std::lock_guard<std::mutex> lock(fMutex);
+                    if (--fPending == 0) {
+                        fIdle.notify_all();
+                    }
+                    continue;
+                }
+
+                // Sleep until a task is queued anywhere (fQueued is counted after the push)
+                std::unique_lock<std::mutex> lock(fMutex);
+                fWake.wait(lock, [this] { return fQueued > 0 || fStop; });
+                if (fStop) return;
+            }
+        }
+
+        std::vector<std::unique_ptr<Queue>> fQueues;
+        std::vector<std::thread> fThreads;
+        std::deque<std::function<void()>> fShared;  // Tasks submitted from outside the pool
+        std::mutex fMutex;                          // Guards fShared, the counts and fStop
+        std::condition_variable fWake;
+        std::condition_variable fIdle;
+        long fPending = 0;                          // Submitted tasks not yet finished
+        long fQueued = 0;                           // Submitted tasks not yet taken
+        bool fStop = false;
+
+        // Pool and deque of the calling thread
+        static thread_local WorkStealingPool* tPool;
+        static thread_local int tIndex;
+    };
+
+    inline thread_local WorkStealingPool* WorkStealingPool::tPool = nullptr;
+    inline thread_local int WorkStealingPool::tIndex = 0;
+}
+
+#endif // HRPPD_WORKSTEALINGPOOL_H
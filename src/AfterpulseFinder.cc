@@ -0,0 +1,51 @@
+#include "../include/AfterpulseFinder.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace HRPPD {
+
+int AfterpulseFinder::Find(WaveformView waveform, float threshold, std::vector<Pulse>& pulses) const {
+    pulses.clear();
+
+    int windowMin = std::max(fWindowMin, 0);
+    int windowMax = std::min<int>(fWindowMax, waveform.size());
+    float level = -std::abs(threshold);
+
+    Pulse pulse;
+    bool inPulse = false;
+    auto close = [&]() {
+        if (pulse.width * fDeltaT > fMinToT) {
+            pulses.push_back(pulse);
+        }
+        inPulse = false;
+    };
+
+    for (int i = windowMin; i < windowMax; i++) {
+        float sample = waveform[i];
+        if (sample < level) {
+            if (!inPulse) {
+                pulse = Pulse();
+                pulse.start = i;
+                pulse.peakIndex = i;
+                inPulse = true;
+            }
+            pulse.width++;
+            if (-sample > pulse.amplitude) {
+                pulse.amplitude = -sample;
+                pulse.peakIndex = i;
+            }
+        } else if (inPulse) {
+            close();
+        }
+    }
+    // A pulse cut by the end of the window still counts
+    if (inPulse) {
+        close();
+    }
+
+    return pulses.size();
+}
+
+} // namespace HRPPD
@@ -0,0 +1,113 @@
+#include "../include/AnalysisSetup.h"
+#include "../include/RunAnalyzer.h"
+#include "../include/Provenance.h"
+#include "../include/Config.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include "TString.h"
+
+
+namespace HRPPD {
+
+bool ParseCommandLine(int argc, char** argv, const std::vector<std::string>& accepted,
+                      CommandLineOptions& options, std::vector<std::string>& args) {
+    args.clear();
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            args.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for option " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        bool known = std::find(accepted.begin(), accepted.end(), arg) != accepted.end();
+        bool onOff = (value == "on" || value == "off");
+        if (known && arg == "--source" && (value == "ntuple" || value == "raw")) {
+            options.source = value;
+        } else if (known && arg == "--threads" && atoi(value.c_str()) > 0) {
+            options.threads = atoi(value.c_str());
+        } else if (known && arg == "--run-threads" && atoi(value.c_str()) > 0) {
+            options.runThreads = atoi(value.c_str());
+        } else if (known && arg == "--pipeline" && onOff) {
+            options.pipeline = (value == "on");
+        } else if (known && arg == "--rehistogram" && onOff) {
+            options.rehistogram = (value == "on");
+        } else if (known && arg == "--force" && onOff) {
+            options.force = (value == "on");
+        } else {
+            std::cerr << "Unknown option or value: " << arg << " " << value << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string GetRunFile(const std::string& name, int runNumber) {
+    return Form("%s/run%d/%s_Run_%d.root", CONFIG_OUTPUT_PATH.c_str(), runNumber, name.c_str(), runNumber);
+}
+
+AnalysisOptions MakeAnalysisOptions(const std::string& analysisType, int runNumber, const CommandLineOptions& options) {
+    AnalysisOptions analysis;
+    bool doFeatures = false;
+    if (analysisType == "all") {
+        analysis.doWaveform = analysis.doWaveform2D = analysis.doToT = analysis.doTiming = true;
+        analysis.doAmplitude = analysis.doNpe = analysis.doAfterpulse = doFeatures = true;
+    } else {
+        auto has = [&](char flag) { return analysisType.find(flag) != std::string::npos; };
+        analysis.doWaveform = has('w');
+        analysis.doWaveform2D = has('2');
+        analysis.doToT = has('t');
+        analysis.doTiming = has('t');
+        analysis.doAmplitude = has('a');
+        analysis.doNpe = has('n');
+        analysis.doAfterpulse = has('p');
+        doFeatures = has('f');
+        if (!analysis.doWaveform && !analysis.doWaveform2D && !analysis.doToT && !analysis.doAmplitude &&
+            !analysis.doNpe && !analysis.doAfterpulse && !doFeatures) {
+            analysis.doWaveform = CONFIG_DO_WAVEFORM;
+            analysis.doWaveform2D = CONFIG_DO_WAVEFORM2D;
+            analysis.doToT = CONFIG_DO_TOT;
+            analysis.doTiming = CONFIG_DO_TIMING;
+            analysis.doAmplitude = CONFIG_DO_AMPLITUDE;
+            analysis.doNpe = CONFIG_DO_NPE;
+            analysis.doAfterpulse = CONFIG_DO_AFTERPULSE;
+            doFeatures = CONFIG_DO_FEATURES;
+        }
+    }
+    analysis.threads = options.threads;
+    analysis.pipeline = options.pipeline;
+    analysis.preselect = CONFIG_PRESELECT;
+    analysis.maxSnapshots = CONFIG_WAVEFORM_SNAPSHOTS;
+    if (doFeatures) {
+        analysis.featureFile = GetRunFile("Features", runNumber);
+    }
+    if (CONFIG_SIGNAL_INDEX) {
+        analysis.signalIndexFile = GetRunFile("SignalIndex", runNumber);
+    }
+    return analysis;
+}
+
+bool IsUpToDate(int runNumber, const std::vector<int>& channels, int maxEvents,
+                const AnalysisOptions& analysis, const std::string& source) {
+    std::string analysisFileName = GetRunFile("Analysis", runNumber);
+    std::string previous = Provenance::Read(analysisFileName);
+    if (previous.empty()) {
+        return false;
+    }
+    std::string current = Provenance::ForRun(runNumber, channels, maxEvents, analysis, source).GetText();
+    if (previous == current) {
+        std::cout << "=== Run " << runNumber << " is up to date, skipped (--force on to analyse it again): " 
+                  << analysisFileName << " ===" << std::endl;
+        return true;
+    }
+    std::cout << "Inputs of " << analysisFileName << " changed:" << std::endl 
+              << Provenance::Diff(previous, current);
+    return false;
+}
+
+} // namespace HRPPD
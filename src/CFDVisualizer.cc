@@ -0,0 +1,191 @@
+#include "../include/CFDVisualizer.h"
+#include "../include/CFDSpline.h"
+#include "../include/DataIO.h"
+
+#include <algorithm>
+#include <TH1D.h>
+#include <TGraph.h>
+#include <TCanvas.h>
+#include <TStyle.h>
+#include <TLine.h>
+#include <TMarker.h>
+#include <TLegend.h>
+#include <TString.h>
+
+
+namespace HRPPD {
+
+// splitmix64 finalizer
+static uint64_t Mix(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Key of (seed, run, event number): distinct events get distinct, uniformly spread keys, and
+// each run its own sample
+static uint64_t SampleKey(int runNumber, int eventNum, unsigned int seed) {
+    return Mix(Mix(((uint64_t)seed << 32) ^ (uint32_t)runNumber) ^ (uint32_t)eventNum);
+}
+
+CFDVisualizer::CFDVisualizer(const std::string& dirName, int maxRecords, int runNumber, unsigned int seed) :
+    fDirName(dirName),
+    fMaxRecords(std::max(maxRecords, 0)),
+    fRunNumber(runNumber),
+    fSeed(seed) {
+    fRecords.reserve(fMaxRecords);
+    fKeys.reserve(fMaxRecords);
+}
+
+CFDRecord* CFDVisualizer::Next(int eventNum) {
+    if (fMaxRecords == 0) return nullptr;
+    
+    fSeen++;
+    fHasPending = false;
+    uint64_t key = SampleKey(fRunNumber, eventNum, fSeed);
+    // Would not be kept even with a crossing
+    if ((int)fRecords.size() >= fMaxRecords && key >= fKeys[fMaxSlot]) return nullptr;
+    
+    fPendingKey = key;
+    fHasPending = true;
+    return &fPending;
+}
+
+void CFDVisualizer::Keep() {
+    if (!fHasPending) return;
+    fHasPending = false;
+    if (fPending.crossingBin <= 0) return;
+    
+    CFDRecord* record = Insert(fPendingKey);
+    if (record) *record = fPending;
+}
+
+void CFDVisualizer::Merge(const CFDVisualizer& other) {
+    fSeen += other.fSeen;
+    for (size_t i = 0; i < other.fRecords.size(); i++) {
+        CFDRecord* record = Insert(other.fKeys[i]);
+        if (record) *record = other.fRecords[i];
+    }
+}
+
+CFDRecord* CFDVisualizer::Insert(uint64_t key) {
+    if (fMaxRecords == 0) return nullptr;
+    
+    if ((int)fRecords.size() < fMaxRecords) {
+        fRecords.emplace_back();
+        fKeys.push_back(key);
+        if (key > fKeys[fMaxSlot]) fMaxSlot = fKeys.size() - 1;
+        return &fRecords.back();
+    }
+    
+    // Full: the candidate displaces the largest key if it is smaller
+    if (key >= fKeys[fMaxSlot]) return nullptr;
+    int slot = fMaxSlot;
+    fKeys[slot] = key;
+    fMaxSlot = std::max_element(fKeys.begin(), fKeys.end()) - fKeys.begin();
+    return &fRecords[slot];
+}
+
+void CFDVisualizer::Write(DataIO& dataIO) const {
+    std::vector<const CFDRecord*> records;
+    for (const auto& record : fRecords) {
+        records.push_back(&record);
+    }
+    std::sort(records.begin(), records.end(), 
+              [](const CFDRecord* a, const CFDRecord* b) { return a->eventNum < b->eventNum; });
+    
+    gStyle->SetOptStat(0);
+    gStyle->SetOptTitle(1);
+    
+    for (const CFDRecord* record : records) {
+        const int dimSize = record->cfd.size();
+        const int eventNum = record->eventNum;
+        const float deltaT = record->deltaT;
+        const float time = record->time;
+        
+        TH1D* hcfd = new TH1D(Form("hcfd_ch%d_evt%d", record->channel, eventNum), "CFD Signal", dimSize, 0, dimSize * deltaT);
+        hcfd->SetDirectory(nullptr);
+        for (int i = 0; i < dimSize; i++) {
+            hcfd->SetBinContent(i+1, record->cfd[i]);
+        }
+        
+        CFDSpline spline;
+        spline.x0 = hcfd->GetBinCenter(record->fitBinLow);
+        spline.h = (double)(dimSize * deltaT) / dimSize;
+        spline.n = record->fitBinHigh - record->fitBinLow + 1;
+        for (int i = 0; i < spline.n; i++) {
+            spline.y[i] = record->cfd[record->fitBinLow + i - 1];
+        }
+        spline.Build();
+        
+        // A new TCanvas deletes any canvas of the same name in gROOT's list: unique per run and channel
+        TCanvas* c = new TCanvas(Form("CFD_run%d_ch%d_evt%d", fRunNumber, record->channel, eventNum), 
+                                 Form("CFD Analysis - Run %d, Ch %d, Evt%d", fRunNumber, record->channel, eventNum), 900, 600);
+        
+        hcfd->SetLineColor(kBlue);
+        hcfd->SetTitle(Form("CFD Signal - Evt%d", eventNum));
+        hcfd->GetXaxis()->SetTitle("Time [ps]");
+        hcfd->GetYaxis()->SetTitle("Amplitude [mV]");
+        
+        double y_min = hcfd->GetMinimum();
+        double y_max = hcfd->GetMaximum();
+        double margin = 0.2 * (y_max - y_min);
+        hcfd->GetYaxis()->SetRangeUser(y_min - margin, y_max + margin);
+        
+        hcfd->Draw();
+        
+        TGraph* fitted_points = new TGraph();
+        for (int i = record->fitBinLow; i <= record->fitBinHigh; i++) {
+            fitted_points->SetPoint(fitted_points->GetN(), hcfd->GetBinCenter(i), hcfd->GetBinContent(i));
+        }
+        
+        TGraph* spline_curve = new TGraph();
+        double x_min = hcfd->GetBinCenter(record->fitBinLow);
+        double x_max = hcfd->GetBinCenter(record->fitBinHigh);
+        int nSteps = 200;
+        
+        for (int i = 0; i <= nSteps; i++) {
+            double x = x_min + (x_max - x_min) * i / nSteps;
+            spline_curve->SetPoint(i, x, spline.Eval(x));
+        }
+        
+        spline_curve->SetLineColor(kRed);
+        spline_curve->SetLineWidth(2);
+        spline_curve->Draw("L SAME");
+        
+        fitted_points->SetMarkerStyle(20);
+        fitted_points->SetMarkerSize(0.4);
+        fitted_points->SetMarkerColor(kRed);
+        
+        TLine* zero_line = new TLine(record->fitWindowMin * deltaT, 0, record->fitWindowMax * deltaT, 0);
+        zero_line->SetLineStyle(2);
+        zero_line->SetLineColor(kBlack);
+        zero_line->Draw();
+        
+        TMarker* crossing = new TMarker(time, 0, 20);
+        crossing->SetMarkerColor(kRed);
+        crossing->SetMarkerSize(0.8);
+        crossing->SetMarkerStyle(21);
+        crossing->Draw();
+        
+        TLegend* leg = new TLegend(0.65, 0.75, 0.88, 0.88);
+        leg->SetLineWidth(0);
+        leg->AddEntry((TObject*)hcfd, "#font[42]{CFD Signal}", "l");
+        leg->AddEntry((TObject*)spline_curve, "#font[42]{Spline Fit}", "l");
+        leg->AddEntry((TObject*)crossing, Form("#font[42]{Zero Crossing: %.1f ps}", time), "p");
+        leg->Draw();
+        
+        dataIO.Save(c, fDirName);
+        
+        delete fitted_points;
+        delete spline_curve;
+        delete zero_line;
+        delete crossing;
+        delete leg;
+        delete c;
+        delete hcfd;
+    }
+}
+
+} // namespace HRPPD
@@ -2,6 +2,8 @@
 
 #include <iostream>
 #include <limits>
+#include <stdexcept>
+#include <algorithm>
 
 
 namespace HRPPD {
@@ -10,6 +12,9 @@ namespace HRPPD {
 std::string CONFIG_OUTPUT_PATH = "../output";
 std::string CONFIG_RAWDATA_PATH = "/u/user/haeun/SE_UserHome/ANL/MCP_Data/Feb2023/HRPPD6";
 std::string CONFIG_NTUPLE_PATH = "../data";
+int CONFIG_NTUPLE_THREADS = 0;
+std::string CONFIG_NTUPLE_FORMAT = "ttree";
+std::string CONFIG_NTUPLE_CHANNELS = "all";
 float CONFIG_TRIGGER_CFD_FRACTION = 0.5f;
 int CONFIG_TRIGGER_CFD_DELAY = 3;
 int CONFIG_TRIGGER_WINDOW_MIN = 200;
@@ -20,6 +25,7 @@ int CONFIG_MCP_WINDOW_MIN = 500;
 int CONFIG_MCP_WINDOW_MAX = 600;
 float CONFIG_FFT_CUTOFF_FREQUENCY = 0.7e9f;
 bool CONFIG_APPLY_FFT_FILTER = false;
+std::string CONFIG_FILTER_MODE = "fft";
 float CONFIG_CALIBRATION_CONSTANT = 0.48828125f;
 float CONFIG_DELTA_T = 200.0f;
 float CONFIG_SAMPLING_RATE = 5.0e9f;
@@ -29,6 +35,17 @@ bool CONFIG_DO_TOT = true;
 bool CONFIG_DO_TIMING = true;
 bool CONFIG_DO_AMPLITUDE = true;
 bool CONFIG_DO_NPE = true;
+bool CONFIG_DO_AFTERPULSE = true;
+int CONFIG_AFTERPULSE_WINDOW_MIN = 679;
+int CONFIG_AFTERPULSE_WINDOW_MAX = 999;
+float CONFIG_AFTERPULSE_MIN_TOT = 800.;
+bool CONFIG_PRESELECT = true;
+bool CONFIG_SIGNAL_INDEX = true;
+bool CONFIG_DO_FEATURES = true;
+float CONFIG_REHIST_THRESHOLD = 4.;
+float CONFIG_REHIST_MIN_TOT = 800.;
+int CONFIG_WAVEFORM_SNAPSHOTS = -1;
+int CONFIG_CFD_VISUALIZE_EVENTS = 200;
 
 // Configuration file loading function
 bool Load(const std::string& configFile) {
@@ -68,6 +85,18 @@ bool Load(const std::string& configFile) {
             else if (key == "ntuple_path") {
                 CONFIG_NTUPLE_PATH = value;
             }
+            else if (key == "ntuple_format") {
+                CONFIG_NTUPLE_FORMAT = value;
+            }
+            else if (key == "ntuple_channels") {
+                CONFIG_NTUPLE_CHANNELS = value;
+            }
+            else if (key == "ntuple_threads") {
+                try { 
+                    CONFIG_NTUPLE_THREADS = std::stoi(value); 
+                }
+                catch (...) { std::cerr << "Warning: Failed to convert ntuple_threads" << std::endl; }
+            }
             // Trigger CFD settings
             else if (key == "trigger_cfd_fraction") {
                 try { 
@@ -128,6 +157,13 @@ bool Load(const std::string& configFile) {
             else if (key == "apply_fft_filter") {
                 CONFIG_APPLY_FFT_FILTER = (value == "true");
             }
+            else if (key == "filter_mode") {
+                if (value == "fft" || value == "iir") {
+                    CONFIG_FILTER_MODE = value;
+                } else {
+                    std::cerr << "Warning: Unknown filter_mode " << value << ", using " << CONFIG_FILTER_MODE << std::endl;
+                }
+            }
             // Waveform processor settings
             else if (key == "calibration_constant") {
                 try { 
@@ -166,6 +202,60 @@ bool Load(const std::string& configFile) {
             else if (key == "do_npe") {
                 CONFIG_DO_NPE = (value == "true");
             }
+            else if (key == "do_afterpulse") {
+                CONFIG_DO_AFTERPULSE = (value == "true");
+            }
+            else if (key == "afterpulse_window_min") {
+                try { 
+                    CONFIG_AFTERPULSE_WINDOW_MIN = std::stoi(value); 
+                }
+                catch (...) { std::cerr << "Warning: Failed to convert afterpulse_window_min" << std::endl; }
+            }
+            else if (key == "afterpulse_window_max") {
+                try { 
+                    CONFIG_AFTERPULSE_WINDOW_MAX = std::stoi(value); 
+                }
+                catch (...) { std::cerr << "Warning: Failed to convert afterpulse_window_max" << std::endl; }
+            }
+            else if (key == "afterpulse_min_tot") {
+                try { 
+                    CONFIG_AFTERPULSE_MIN_TOT = std::stof(value); 
+                }
+                catch (...) { std::cerr << "Warning: Failed to convert afterpulse_min_tot" << std::endl; }
+            }
+            else if (key == "preselect") {
+                CONFIG_PRESELECT = (value == "true");
+            }
+            else if (key == "signal_index") {
+                CONFIG_SIGNAL_INDEX = (value == "true");
+            }
+            else if (key == "do_features") {
+                CONFIG_DO_FEATURES = (value == "true");
+            }
+            else if (key == "rehist_threshold") {
+                try { 
+                    CONFIG_REHIST_THRESHOLD = std::stof(value); 
+                }
+                catch (...) { std::cerr << "Warning: Failed to convert rehist_threshold" << std::endl; }
+            }
+            else if (key == "rehist_min_tot") {
+                try { 
+                    CONFIG_REHIST_MIN_TOT = std::stof(value); 
+                }
+                catch (...) { std::cerr << "Warning: Failed to convert rehist_min_tot" << std::endl; }
+            }
+            else if (key == "waveform_snapshots") {
+                try { 
+                    CONFIG_WAVEFORM_SNAPSHOTS = std::stoi(value); 
+                }
+                catch (...) { std::cerr << "Warning: Failed to convert waveform_snapshots" << std::endl; }
+            }
+            else if (key == "cfd_visualize_events") {
+                try { 
+                    CONFIG_CFD_VISUALIZE_EVENTS = std::stoi(value); 
+                }
+                catch (...) { std::cerr << "Warning: Failed to convert cfd_visualize_events" << std::endl; }
+            }
             else {
                 std::cerr << "Warning: Unknown configuration key: " << key << std::endl;
             }
@@ -176,4 +266,77 @@ bool Load(const std::string& configFile) {
     return true;
 }
 
+std::string GetConfigText() {
+    std::ostringstream text;
+    text.precision(9);
+    text << std::boolalpha;
+    auto line = [&text](const char* key, const auto& value) { text << key << " " << value << "\n"; };
+
+    line("rawdata_path", CONFIG_RAWDATA_PATH);
+    line("ntuple_path", CONFIG_NTUPLE_PATH);
+    line("ntuple_format", CONFIG_NTUPLE_FORMAT);
+    line("ntuple_channels", CONFIG_NTUPLE_CHANNELS);
+    line("trigger_cfd_fraction", CONFIG_TRIGGER_CFD_FRACTION);
+    line("trigger_cfd_delay", CONFIG_TRIGGER_CFD_DELAY);
+    line("trigger_window_min", CONFIG_TRIGGER_WINDOW_MIN);
+    line("trigger_window_max", CONFIG_TRIGGER_WINDOW_MAX);
+    line("mcp_cfd_fraction", CONFIG_MCP_CFD_FRACTION);
+    line("mcp_cfd_delay", CONFIG_MCP_CFD_DELAY);
+    line("mcp_window_min", CONFIG_MCP_WINDOW_MIN);
+    line("mcp_window_max", CONFIG_MCP_WINDOW_MAX);
+    line("fft_cutoff_frequency", CONFIG_FFT_CUTOFF_FREQUENCY);
+    line("apply_fft_filter", CONFIG_APPLY_FFT_FILTER);
+    line("filter_mode", CONFIG_FILTER_MODE);
+    line("calibration_constant", CONFIG_CALIBRATION_CONSTANT);
+    line("delta_t", CONFIG_DELTA_T);
+    line("sampling_rate", CONFIG_SAMPLING_RATE);
+    line("do_waveform", CONFIG_DO_WAVEFORM);
+    line("do_waveform2D", CONFIG_DO_WAVEFORM2D);
+    line("do_tot", CONFIG_DO_TOT);
+    line("do_timing", CONFIG_DO_TIMING);
+    line("do_amplitude", CONFIG_DO_AMPLITUDE);
+    line("do_npe", CONFIG_DO_NPE);
+    line("do_afterpulse", CONFIG_DO_AFTERPULSE);
+    line("afterpulse_window_min", CONFIG_AFTERPULSE_WINDOW_MIN);
+    line("afterpulse_window_max", CONFIG_AFTERPULSE_WINDOW_MAX);
+    line("afterpulse_min_tot", CONFIG_AFTERPULSE_MIN_TOT);
+    line("do_features", CONFIG_DO_FEATURES);
+    line("waveform_snapshots", CONFIG_WAVEFORM_SNAPSHOTS);
+    line("cfd_visualize_events", CONFIG_CFD_VISUALIZE_EVENTS);
+    return text.str();
+}
+
+std::vector<int> ParseChannels(const std::string& channelList) {
+    std::vector<int> channels;
+    if (channelList == "all") {
+        for (int ch = 0; ch < 16; ch++) {
+            channels.push_back(ch);
+        }
+        return channels;
+    }
+    
+    std::istringstream iss(channelList);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        try {
+            size_t pos = 0;
+            int ch = std::stoi(item, &pos);
+            if (pos != item.size() || ch < 0 || ch > 15) {
+                throw std::out_of_range(item);
+            }
+            // A channel listed twice would be loaded twice and write the same output directory
+            if (std::find(channels.begin(), channels.end(), ch) != channels.end()) {
+                std::cerr << "Warning: Channel " << ch << " listed twice: " << channelList << std::endl;
+                return std::vector<int>();
+            }
+            channels.push_back(ch);
+        }
+        catch (...) {
+            std::cerr << "Warning: Invalid channel in list: " << item << std::endl;
+            return std::vector<int>();
+        }
+    }
+    return channels;
+}
+
 } // namespace HRPPD 
\ No newline at end of file
@@ -3,15 +3,19 @@
 #include "../include/Config.h"
 
 #include <iostream>
+#include <algorithm>
 #include <sys/stat.h>
 #include <libgen.h>
 #include "TString.h"
+#include "TParameter.h"
+#include "TBranch.h"
+#include "TKey.h"
 
 
 namespace HRPPD {
 
 DataIO::DataIO() : 
-    fNtuplePath(CONFIG_NTUPLE_PATH), fOutputPath(CONFIG_OUTPUT_PATH),
+    fRawDataPath(CONFIG_RAWDATA_PATH), fNtuplePath(CONFIG_NTUPLE_PATH), fOutputPath(CONFIG_OUTPUT_PATH),
     fAutoNtuplize(true) {
 }
 
@@ -23,7 +27,29 @@ void DataIO::SetPath(const std::string& outputPath) {
     fOutputPath = outputPath;
 }
 
+void DataIO::SetNtuplePath(const std::string& ntuplePath) {
+    fNtuplePath = ntuplePath;
+}
+
+void DataIO::SetRawDataPath(const std::string& rawDataPath) {
+    fRawDataPath = rawDataPath;
+}
+
 bool DataIO::Load(int runNumber, const int channelNumber, bool autoNtuplize) {
+    return Load(runNumber, std::vector<int>{channelNumber}, autoNtuplize);
+}
+
+bool DataIO::Load(int runNumber, const std::vector<int>& channels, bool autoNtuplize) {
+    if (channels.empty()) {
+        std::cerr << "Error: No MCP channel to load" << std::endl;
+        return false;
+    }
+    fRunNumber = runNumber;
+    fChannels = channels;
+    if (fSource == Source::kRaw) {
+        return LoadRaw(runNumber);
+    }
+    
     std::string ntuplePath = Ntupler::GetPath(runNumber, fNtuplePath);
     
     bool ntupleExists = Ntupler::Check(runNumber, fNtuplePath);
@@ -48,7 +74,8 @@ bool DataIO::Load(int runNumber, const int channelNumber, bool autoNtuplize) {
         return false;
     }
     
-    Close(ntuplePath);
+    // Only one input is held at a time
+    CloseInput();
     
     // Open the ntuple file
     fInputFile = TFile::Open(ntuplePath.c_str(), "READ");
@@ -57,32 +84,235 @@ bool DataIO::Load(int runNumber, const int channelNumber, bool autoNtuplize) {
         return false;
     }
     
+    // Branch addresses point into these, so they are sized once per Load
+    const int nChannels = fChannels.size();
+    fTriggerWaveform = nullptr;
+    fMcpWaveform.assign(nChannels, nullptr);
+    fMcpArray.assign(nChannels * kMaxSamples, 0.f);
+    fMcpBulk.clear();
+    fMcpBulk.resize(nChannels);
+    fTriggerData = nullptr;
+    fMcpData.assign(nChannels, nullptr);
+    
+    // MCPTree is either a TTree or an RNTuple, depending on the ntuple_format it was written with
+    TKey* key = fInputFile->GetKey("MCPTree");
+    if (key && std::string(key->GetClassName()).find("RNTuple") != std::string::npos) {
+        CloseInput();
+        return LoadRNTuple(ntuplePath);
+    }
+    
     fTree = (TTree*)fInputFile->Get("MCPTree");
     if (!fTree) {
         std::cerr << "Error: Cannot find ntuple tree" << std::endl;
         Close(ntuplePath);
         return false;
     }
+    fBackend = Backend::kTTree;
     
-    fTriggerWaveform = nullptr;
-    fMcpWaveform = nullptr;
-    fChannelNumber = channelNumber;
+    // Files written before the schema was versioned carry no UserInfo entry
+    fSchemaVersion = 1;
+    TParameter<int>* version = dynamic_cast<TParameter<int>*>(fTree->GetUserInfo()->FindObject("schemaVersion"));
+    if (version) {
+        fSchemaVersion = version->GetVal();
+    }
+    if (fSchemaVersion < 1 || fSchemaVersion > Ntupler::kSchemaVersion) {
+        std::cerr << "Error: Unsupported ntuple schema version " << fSchemaVersion << std::endl;
+        Close(ntuplePath);
+        return false;
+    }
+    
+    // Connect MCP channel branches
+    std::vector<TString> mcpBranchNames;
+    for (int channel : fChannels) {
+        mcpBranchNames.push_back(Form("mcpWave%d", channel));
+        if (!fTree->GetBranch(mcpBranchNames.back())) {
+            std::cerr << "Error: Branch " << mcpBranchNames.back() << " does not exist" << std::endl;
+            CloseInput();
+            return false;
+        }
+    }
     
-    fTree->SetBranchAddress("eventNumber", &fEventNum);
-    fTree->SetBranchAddress("triggerWave", &fTriggerWaveform);
+    // Deactivate everything this job does not read, so GetEntry and the TTreeCache
+    // only fetch and decompress the trigger and the requested channels
+    std::vector<const char*> activeBranches = {"eventNumber", "triggerWave"};
+    for (const TString& name : mcpBranchNames) {
+        activeBranches.push_back(name.Data());
+    }
+    fTree->SetBranchStatus("*", false);
+    fTree->SetCacheSize(32 * 1024 * 1024);
+    for (const char* name : activeBranches) {
+        fTree->SetBranchStatus(name, true);
+        fTree->AddBranchToCache(name, true);
+    }
+    fTree->StopCacheLearningPhase();
     
-    // Connect MCP channel branch
-    TString mcpBranchName = Form("mcpWave%d", fChannelNumber);
-    if (fTree->GetBranch(mcpBranchName)) {
-        fTree->SetBranchAddress(mcpBranchName, &fMcpWaveform);
+    if (fSchemaVersion == 1) {
+        fTree->SetBranchAddress("eventNumber", &fEventNum);
+        fTree->SetBranchAddress("triggerWave", &fTriggerWaveform);
+        for (int i = 0; i < nChannels; i++) {
+            fTree->SetBranchAddress(mcpBranchNames[i], &fMcpWaveform[i]);
+        }
     } else {
-        std::cerr << "Warning: Branch " << mcpBranchName << " does not exist" << std::endl;
+        fNSamples = kMaxSamples;
+        fTree->SetBranchAddress("eventNumber", &fEventNum);
+        fTree->SetBranchAddress("triggerWave", fTriggerArray);
+        for (int i = 0; i < nChannels; i++) {
+            fTree->SetBranchAddress(mcpBranchNames[i], &fMcpArray[i * kMaxSamples]);
+        }
+        
+        fUseBulk = InitBulk(fEventBulk, "eventNumber", sizeof(int)) &&
+                   InitBulk(fTriggerBulk, "triggerWave", sizeof(fTriggerArray));
+        for (int i = 0; i < nChannels && fUseBulk; i++) {
+            fUseBulk = InitBulk(fMcpBulk[i], mcpBranchNames[i], kMaxSamples * sizeof(float));
+        }
+        if (!fUseBulk) {
+            std::cout << "Bulk read unavailable, falling back to TTree::GetEntry" << std::endl;
+            UseBranchBuffers();
+        }
+    }
+    
+    std::cout << "Ntuple schema version " << fSchemaVersion 
+              << (fUseBulk ? " (bulk read)" : "") << std::endl;
+    
+    return true;
+}
+
+bool DataIO::OpenInput(const DataIO& other) {
+    fRawDataPath = other.fRawDataPath;
+    fNtuplePath = other.fNtuplePath;
+    fSource = other.fSource;
+    // The ntuple was already converted (if needed) when other loaded it
+    return Load(other.fRunNumber, other.fChannels, false);
+}
+
+void DataIO::UseBranchBuffers() {
+    fTriggerData = fTriggerArray;
+    for (size_t i = 0; i < fChannels.size(); i++) {
+        fMcpData[i] = &fMcpArray[i * kMaxSamples];
+    }
+}
+
+bool DataIO::LoadRaw(int runNumber) {
+    CloseInput();
+    
+    // Same run directory layout as the Ntupler
+    std::string runDir = Ntupler::GetRunDir(runNumber, fRawDataPath);
+    std::string triggerFile = runDir + "/TR_0_0.dat";
+    
+    if (!fTriggerReader.Open(triggerFile)) {
+        std::cerr << "Error: Cannot open trigger file - " << triggerFile << std::endl;
+        return false;
+    }
+    fMcpReaders.resize(fChannels.size());
+    for (size_t i = 0; i < fChannels.size(); i++) {
+        std::string mcpFile = runDir + "/wave_" + std::to_string(fChannels[i]) + ".dat";
+        if (!fMcpReaders[i].Open(mcpFile)) {
+            std::cerr << "Error: Cannot open channel " << fChannels[i] << " file - " << mcpFile << std::endl;
+            CloseInput();
+            return false;
+        }
+        if (fMcpReaders[i].GetEntries() < fTriggerReader.GetEntries()) {
+            std::cout << "Warning: " << mcpFile << " holds fewer events than the trigger file, using "
+                      << fMcpReaders[i].GetEntries() << " events" << std::endl;
+        }
+    }
+    
+    fBackend = Backend::kRaw;
+    fSchemaVersion = 0;
+    fNSamples = RawReader::kSamplesPerEvent;
+    fTriggerData = nullptr;
+    fMcpData.assign(fChannels.size(), nullptr);
+    
+    std::cout << "Reading raw data directly from " << runDir << std::endl;
+    
+    return true;
+}
+
+bool DataIO::LoadRNTuple(const std::string& ntuplePath) {
+    using ROOT::Experimental::RNTupleReader;
+    
+    try {
+        fNTuple = RNTupleReader::Open("MCPTree", ntuplePath);
+        fEventView.reset(new ROOT::Experimental::RNTupleView<int>(fNTuple->GetView<int>("eventNumber")));
+        // View the float item column of each std::array<float, 1024> field, so a
+        // waveform can be mapped directly out of the decompressed page
+        fTriggerView.reset(new FloatView(fNTuple->GetView<float>("triggerWave._0")));
+        fMcpViews.clear();
+        for (int channel : fChannels) {
+            std::string mcpFieldName = Form("mcpWave%d._0", channel);
+            fMcpViews.emplace_back(new FloatView(fNTuple->GetView<float>(mcpFieldName)));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Cannot read RNTuple " << ntuplePath << " (" << e.what() << ")" << std::endl;
+        CloseInput();
         return false;
     }
     
+    fBackend = Backend::kRNTuple;
+    fNTupleFileName = ntuplePath;
+    fSchemaVersion = Ntupler::kSchemaVersion;
+    fNSamples = kMaxSamples;
+    fMcpArray.assign(fChannels.size() * kMaxSamples, 0.f);
+    fMcpData.assign(fChannels.size(), nullptr);
+    
+    std::cout << "Ntuple format RNTuple" << std::endl;
+    
     return true;
 }
 
+const float* DataIO::MapWaveform(FloatView& view, Long64_t entry, float* staging) {
+    ROOT::Experimental::NTupleSize_t first = entry * fNSamples;
+    ROOT::Experimental::NTupleSize_t nItems = 0;
+    const float* data = view.MapV(first, nItems);
+    if (nItems >= (ROOT::Experimental::NTupleSize_t)fNSamples) {
+        return data;
+    }
+    
+    // The waveform straddles a page boundary: gather it into the staging buffer
+    int copied = 0;
+    while (copied < fNSamples) {
+        int n = std::min<int>(nItems, fNSamples - copied);
+        std::copy(data, data + n, staging + copied);
+        copied += n;
+        if (copied < fNSamples) {
+            data = view.MapV(first + copied, nItems);
+        }
+    }
+    return staging;
+}
+
+bool DataIO::InitBulk(BulkBranch& bulk, const char* branchName, int entrySize) {
+    bulk.branch = fTree->GetBranch(branchName);
+    bulk.first = 0;
+    bulk.count = 0;
+    bulk.entrySize = entrySize;
+    if (!bulk.branch || !bulk.branch->SupportsBulkRead()) {
+        return false;
+    }
+    if (!bulk.buffer) {
+        bulk.buffer.reset(new TBufferFile(TBuffer::kWrite, 64 * entrySize));
+    }
+    return true;
+}
+
+const char* DataIO::ReadBulk(BulkBranch& bulk, Long64_t entry) {
+    if (entry < bulk.first || entry >= bulk.first + bulk.count) {
+        // Locate the basket holding this entry and deserialize all of it at once
+        Long64_t* basketEntry = bulk.branch->GetBasketEntry();
+        int nBaskets = bulk.branch->GetWriteBasket();
+        Long64_t* basket = std::upper_bound(basketEntry, basketEntry + nBaskets + 1, entry) - 1;
+        
+        Int_t count = bulk.branch->GetBulkRead().GetBulkEntries(*basket, *bulk.buffer);
+        if (count <= 0) {
+            bulk.count = 0;
+            return nullptr;
+        }
+        bulk.first = *basket;
+        bulk.count = count;
+    }
+    return bulk.buffer->GetCurrent() + (entry - bulk.first) * bulk.entrySize;
+}
+
 bool DataIO::SetFile(const std::string& fileName) {
     Close(fileName);
     
@@ -101,15 +331,32 @@ bool DataIO::SetFile(const std::string& fileName) {
     return true;
 }
 
+void DataIO::CloseInput() {
+    if (fInputFile) {
+        fTree = nullptr; // Tree belongs to file
+        fUseBulk = false;
+        fInputFile->Close();
+        delete fInputFile;
+        fInputFile = nullptr;
+    }
+    
+    // Views must go before the reader they were created from
+    fEventView.reset();
+    fTriggerView.reset();
+    fMcpViews.clear();
+    fNTuple.reset();
+    fNTupleFileName.clear();
+    
+    fTriggerReader.Close();
+    fMcpReaders.clear();
+    
+    fBackend = Backend::kNone;
+}
+
 void DataIO::Close(const std::string& fileName) {
     // If file name is empty, close all files
     if (fileName.empty()) {
-        if (fInputFile) {
-            fTree = nullptr; // Tree belongs to file
-            fInputFile->Close();
-            delete fInputFile;
-            fInputFile = nullptr;
-        }
+        CloseInput();
         
         if (fOutputFile) {
             fOutputFile->Write();
@@ -121,11 +368,8 @@ void DataIO::Close(const std::string& fileName) {
     }
     
     // If file name is given, close only that file
-    if (fInputFile && fileName == fInputFile->GetName()) {
-        fTree = nullptr; // Tree belongs to file
-        fInputFile->Close();
-        delete fInputFile;
-        fInputFile = nullptr;
+    if ((fInputFile && fileName == fInputFile->GetName()) || fileName == fNTupleFileName) {
+        CloseInput();
     }
     else if (fOutputFile && fileName == fOutputFile->GetName()) {
         fOutputFile->Write();
@@ -136,38 +380,143 @@ void DataIO::Close(const std::string& fileName) {
 }
 
 bool DataIO::GetEvent(int eventIndex) {
-    if (!fTree) {
+    if (fBackend == Backend::kNone) {
         std::cerr << "Error: Tree not loaded" << std::endl;
         return false;
     }
     
-    if (eventIndex < 0 || eventIndex >= fTree->GetEntries()) {
-        std::cerr << "Error: Event index out of range (" << eventIndex << "/" << fTree->GetEntries() << ")" << std::endl;
+    if (eventIndex < 0 || eventIndex >= GetEntries()) {
+        std::cerr << "Error: Event index out of range (" << eventIndex << "/" << GetEntries() << ")" << std::endl;
         return false;
     }
     
+    if (fBackend == Backend::kRaw) {
+        fEventNum = eventIndex;
+        fTriggerData = fTriggerReader.GetEvent(eventIndex);
+        for (size_t i = 0; i < fMcpReaders.size(); i++) {
+            fMcpData[i] = fMcpReaders[i].GetEvent(eventIndex);
+        }
+        return true;
+    }
+    
+    if (fBackend == Backend::kRNTuple) {
+        fEventNum = (*fEventView)(eventIndex);
+        fTriggerData = MapWaveform(*fTriggerView, eventIndex, fTriggerArray);
+        for (size_t i = 0; i < fMcpViews.size(); i++) {
+            fMcpData[i] = MapWaveform(*fMcpViews[i], eventIndex, &fMcpArray[i * kMaxSamples]);
+        }
+        return true;
+    }
+    
+    if (fUseBulk) {
+        const char* eventData = ReadBulk(fEventBulk, eventIndex);
+        const char* trigData = ReadBulk(fTriggerBulk, eventIndex);
+        bool ok = eventData && trigData;
+        for (size_t i = 0; i < fMcpBulk.size() && ok; i++) {
+            const char* mcpData = ReadBulk(fMcpBulk[i], eventIndex);
+            fMcpData[i] = reinterpret_cast<const float*>(mcpData);
+            ok = (mcpData != nullptr);
+        }
+        if (ok) {
+            fEventNum = *reinterpret_cast<const int*>(eventData);
+            fTriggerData = reinterpret_cast<const float*>(trigData);
+            return true;
+        }
+        std::cerr << "Warning: Bulk read failed at entry " << eventIndex 
+                  << ", falling back to TTree::GetEntry" << std::endl;
+        fUseBulk = false;
+        UseBranchBuffers();
+    }
+    
     fTree->GetEntry(eventIndex);
+    
+    if (fSchemaVersion == 1) {
+        fTriggerData = fTriggerWaveform->data();
+        for (size_t i = 0; i < fMcpWaveform.size(); i++) {
+            fMcpData[i] = fMcpWaveform[i]->data();
+        }
+        fNSamples = fMcpWaveform[0]->size();
+    }
     return true;
 }
 
 int DataIO::GetEntries() const {
-    return fTree ? fTree->GetEntries() : 0;
+    switch (fBackend) {
+        case Backend::kTTree:   return fTree->GetEntries();
+        case Backend::kRNTuple: return fNTuple->GetNEntries();
+        case Backend::kRaw: {
+            int entries = fTriggerReader.GetEntries();
+            for (const RawReader& reader : fMcpReaders) {
+                entries = std::min(entries, reader.GetEntries());
+            }
+            return entries;
+        }
+        default:                return 0;
+    }
+}
+
+std::vector<std::string> DataIO::GetInputFiles() const {
+    if (fBackend == Backend::kRaw) {
+        std::string runDir = Ntupler::GetRunDir(fRunNumber, fRawDataPath);
+        std::vector<std::string> files = {runDir + "/TR_0_0.dat"};
+        for (int channel : fChannels) {
+            files.push_back(runDir + "/wave_" + std::to_string(channel) + ".dat");
+        }
+        return files;
+    }
+    return {Ntupler::GetPath(fRunNumber, fNtuplePath)};
+}
+
+std::vector<std::pair<int, int>> DataIO::GetClusterRanges(int nEntries) const {
+    std::vector<std::pair<int, int>> ranges;
+    nEntries = std::min(nEntries, GetEntries());
+    
+    if (fBackend == Backend::kTTree) {
+        // Chunks that start on a cluster boundary never share a basket or a TTreeCache block
+        TTree::TClusterIterator clusters = fTree->GetClusterIterator(0);
+        Long64_t first;
+        while ((first = clusters()) < nEntries) {
+            Long64_t last = std::min<Long64_t>(clusters.GetNextEntry(), nEntries);
+            if (last <= first) break;
+            ranges.emplace_back(first, last);
+        }
+        int covered = ranges.empty() ? 0 : ranges.back().second;
+        if (covered < nEntries) {
+            ranges.emplace_back(covered, nEntries);
+        }
+        return ranges;
+    }
+    
+    for (int first = 0; first < nEntries; first += kChunkSize) {
+        ranges.emplace_back(first, std::min(first + kChunkSize, nEntries));
+    }
+    return ranges;
 }
 
 std::vector<float> DataIO::GetWaveform(const std::string& type) const {
     std::vector<float> waveform;
-    if (type == "trigger") {
-        waveform = *fTriggerWaveform;
+    if (type == "trigger" && fTriggerData) {
+        waveform.assign(fTriggerData, fTriggerData + fNSamples);
     } 
-    else if (type == "mcp") {
-        waveform = *fMcpWaveform;
+    else if (type == "mcp" && !fMcpData.empty() && fMcpData[0]) {
+        waveform.assign(fMcpData[0], fMcpData[0] + fNSamples);
     }
     
     return waveform;
 }
 
-void DataIO::Save(TH1* hist, const std::string& dirName) {
-    if (!fOutputFile || !hist) {
+WaveformView DataIO::GetWaveformView(WaveformType type, int channelIndex) const {
+    const float* data = nullptr;
+    if (type == WaveformType::kTrigger) {
+        data = fTriggerData;
+    } else if (channelIndex >= 0 && channelIndex < (int)fMcpData.size()) {
+        data = fMcpData[channelIndex];
+    }
+    return data ? WaveformView(data, fNSamples) : WaveformView();
+}
+
+void DataIO::Save(TObject* obj, const std::string& dirName) {
+    if (!fOutputFile || !obj) {
         return;
     }
     
@@ -183,10 +532,25 @@ void DataIO::Save(TH1* hist, const std::string& dirName) {
         fOutputFile->cd();
     }
     
-    hist->Write();
+    obj->Write();
     currentDir->cd();
 }
 
+TDirectory* DataIO::GetDir(const std::string& dirName) {
+    if (!fOutputFile) {
+        return nullptr;
+    }
+    if (dirName.empty()) {
+        return fOutputFile;
+    }
+    
+    TDirectory* dir = fOutputFile->GetDirectory(dirName.c_str());
+    if (!dir) {
+        dir = fOutputFile->mkdir(dirName.c_str());
+    }
+    return dir;
+}
+
 void DataIO::SetDir(const std::string& dirName) {
     if (!fOutputFile) {
         return;
@@ -0,0 +1,261 @@
+#include "../include/FFTFilterEngine.h"
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+#include <TVirtualFFT.h>
+#include <TH1D.h>
+#ifdef HRPPD_HAVE_FFTW
+#include <fftw3.h>
+#endif
+
+
+namespace HRPPD {
+
+PowerSpectrum::PowerSpectrum(int size) :
+    fSize(size),
+    fSum(size / 2 + 1, 0.) {
+}
+
+void PowerSpectrum::Add(const double* re, const double* im) {
+    for (int k = 0; k < GetNFrequencies(); k++) {
+        fSum[k] += (re[k] * re[k] + im[k] * im[k]) / fSize;
+    }
+    fEntries++;
+}
+
+void PowerSpectrum::AddInterleaved(const double* reIm) {
+    for (int k = 0; k < GetNFrequencies(); k++) {
+        double re = reIm[2 * k];
+        double im = reIm[2 * k + 1];
+        fSum[k] += (re * re + im * im) / fSize;
+    }
+    fEntries++;
+}
+
+void PowerSpectrum::Add(const PowerSpectrum& other) {
+    if (other.fSize != fSize) return;
+    for (size_t k = 0; k < fSum.size(); k++) {
+        fSum[k] += other.fSum[k];
+    }
+    fEntries += other.fEntries;
+}
+
+void PowerSpectrum::Reset() {
+    std::fill(fSum.begin(), fSum.end(), 0.);
+    fEntries = 0;
+}
+
+std::vector<double> PowerSpectrum::GetAverage() const {
+    std::vector<double> average(fSum.size(), 0.);
+    if (fEntries == 0) return average;
+    for (size_t k = 0; k < fSum.size(); k++) {
+        average[k] = fSum[k] / fEntries;
+    }
+    return average;
+}
+
+TH1D* PowerSpectrum::MakeHistogram(const std::string& name, const std::string& title, float samplingRate) const {
+    // Same binning as the magnitude spectrum of the old FFTFilter: N/2 bins up to Nyquist
+    int nBins = fSize / 2;
+    TH1D* hist = new TH1D(name.c_str(), title.c_str(), nBins, 0., samplingRate / 2.);
+    hist->SetDirectory(nullptr);
+    
+    std::vector<double> average = GetAverage();
+    for (int k = 0; k < nBins; k++) {
+        if (average[k] > 0.) {
+            hist->SetBinContent(k + 1, 10. * std::log10(average[k]));
+        }
+    }
+    hist->SetEntries(fEntries);
+    return hist;
+}
+
+// The FFTW planner and plan destruction are not thread-safe; engines of different threads
+// take turns here, while executing a plan (Filter) needs no lock
+static std::mutex& PlanMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+// kBatchSize transforms laid out back to back: fSamples holds kBatchSize * size reals,
+// fSpectra kBatchSize * (size/2+1) complex bins. The buffers come from fftw_malloc (SIMD aligned).
+struct FFTFilterEngine::BatchPlans {
+#ifdef HRPPD_HAVE_FFTW
+    double* fSamples = nullptr;
+    fftw_complex* fSpectra = nullptr;
+    fftw_plan fForward = nullptr;
+    fftw_plan fBackward = nullptr;
+#endif
+};
+
+FFTFilterEngine::FFTFilterEngine(int size) :
+    fSize(size),
+    fTransfer(size / 2 + 1, 1.),
+    fSamples(size),
+    fRe(size / 2 + 1),
+    fIm(size / 2 + 1) {
+    // "K" keeps the plans out of TVirtualFFT's global current transform, so they are
+    // neither replaced nor deleted by other FFT users (TH1::FFT etc.)
+    {
+        std::lock_guard<std::mutex> lock(PlanMutex());
+        fForward = TVirtualFFT::FFT(1, &fSize, "R2C ES K");
+        fBackward = TVirtualFFT::FFT(1, &fSize, "C2R ES K");
+    }
+    if (!IsValid()) {
+        std::cerr << "Error: Failed to create FFT plans of size " << fSize << " (ROOT built without FFTW?)" << std::endl;
+    }
+}
+
+FFTFilterEngine::~FFTFilterEngine() {
+    std::lock_guard<std::mutex> lock(PlanMutex());
+    delete fForward;
+    delete fBackward;
+    if (fBatch) {
+#ifdef HRPPD_HAVE_FFTW
+        if (fBatch->fForward) fftw_destroy_plan(fBatch->fForward);
+        if (fBatch->fBackward) fftw_destroy_plan(fBatch->fBackward);
+        fftw_free(fBatch->fSamples);
+        fftw_free(fBatch->fSpectra);
+#endif
+        delete fBatch;
+    }
+}
+
+bool FFTFilterEngine::CreateBatchPlans() {
+#ifdef HRPPD_HAVE_FFTW
+    if (fBatch) return fBatch->fForward && fBatch->fBackward;
+
+    const int nFreq = GetNFrequencies();
+    fBatch = new BatchPlans();
+    fBatch->fSamples = fftw_alloc_real((size_t)kBatchSize * fSize);
+    fBatch->fSpectra = fftw_alloc_complex((size_t)kBatchSize * nFreq);
+    if (fBatch->fSamples && fBatch->fSpectra) {
+        // FFTW_ESTIMATE, as the "ES" plans of Filter(): planning does not touch the buffers
+        std::lock_guard<std::mutex> lock(PlanMutex());
+        fBatch->fForward = fftw_plan_many_dft_r2c(1, &fSize, kBatchSize,
+                                                  fBatch->fSamples, nullptr, 1, fSize,
+                                                  fBatch->fSpectra, nullptr, 1, nFreq, FFTW_ESTIMATE);
+        fBatch->fBackward = fftw_plan_many_dft_c2r(1, &fSize, kBatchSize,
+                                                   fBatch->fSpectra, nullptr, 1, nFreq,
+                                                   fBatch->fSamples, nullptr, 1, fSize, FFTW_ESTIMATE);
+    }
+    if (!fBatch->fForward || !fBatch->fBackward) {
+        std::cerr << "Error: Failed to create batched FFT plans of size " << fSize << " x " << kBatchSize << std::endl;
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void FFTFilterEngine::SetTransfer(const std::vector<double>& transfer) {
+    if ((int)transfer.size() != GetNFrequencies()) {
+        std::cerr << "Error: Transfer function has " << transfer.size() << " bins, expected " 
+                  << GetNFrequencies() << std::endl;
+        return;
+    }
+    fTransfer = transfer;
+}
+
+bool FFTFilterEngine::Filter(const float* input, float* output, PowerSpectrum* spectrum) {
+    if (!IsValid()) return false;
+    if (spectrum && spectrum->GetSize() != fSize) {
+        std::cerr << "Error: Power spectrum size " << spectrum->GetSize() << " does not match FFT size " << fSize << std::endl;
+        return false;
+    }
+
+    for (int i = 0; i < fSize; i++) {
+        fSamples[i] = input[i];
+    }
+    fForward->SetPoints(fSamples.data());
+    fForward->Transform();
+    fForward->GetPointsComplex(fRe.data(), fIm.data());
+    
+    if (spectrum) {
+        spectrum->Add(fRe.data(), fIm.data());
+    }
+
+    for (int k = 0; k < GetNFrequencies(); k++) {
+        fRe[k] *= fTransfer[k];
+        fIm[k] *= fTransfer[k];
+    }
+
+    fBackward->SetPointsComplex(fRe.data(), fIm.data());
+    fBackward->Transform();
+    fBackward->GetPoints(fSamples.data());
+
+    // FFTW transforms are unnormalized
+    for (int i = 0; i < fSize; i++) {
+        output[i] = fSamples[i] / fSize;
+    }
+    return true;
+}
+
+bool FFTFilterEngine::FilterBatch(const float* input, float* output, int nEvents, int stride, PowerSpectrum* spectrum) {
+    if (stride < fSize) {
+        std::cerr << "Error: FilterBatch stride " << stride << " is shorter than " << fSize << " samples" << std::endl;
+        return false;
+    }
+    if (spectrum && spectrum->GetSize() != fSize) {
+        std::cerr << "Error: Power spectrum size " << spectrum->GetSize() << " does not match FFT size " << fSize << std::endl;
+        return false;
+    }
+
+#ifdef HRPPD_HAVE_FFTW
+    if (!CreateBatchPlans()) return false;
+
+    const int nFreq = GetNFrequencies();
+    double* samples = fBatch->fSamples;
+    fftw_complex* spectra = fBatch->fSpectra;
+    for (int first = 0; first < nEvents; first += kBatchSize) {
+        const int nBlock = std::min(kBatchSize, nEvents - first);
+        for (int b = 0; b < nBlock; b++) {
+            const float* in = input + (size_t)(first + b) * stride;
+            double* row = samples + (size_t)b * fSize;
+            for (int i = 0; i < fSize; i++) {
+                row[i] = in[i];
+            }
+        }
+        // The plans always run kBatchSize transforms; unused rows of a short last block are zeroed
+        std::fill(samples + (size_t)nBlock * fSize, samples + (size_t)kBatchSize * fSize, 0.);
+
+        fftw_execute(fBatch->fForward);
+
+        for (int b = 0; b < nBlock; b++) {
+            fftw_complex* bins = spectra + (size_t)b * nFreq;
+            if (spectrum) {
+                spectrum->AddInterleaved(&bins[0][0]);
+            }
+            for (int k = 0; k < nFreq; k++) {
+                bins[k][0] *= fTransfer[k];
+                bins[k][1] *= fTransfer[k];
+            }
+        }
+
+        // c2r overwrites its input, the spectra are not needed afterwards
+        fftw_execute(fBatch->fBackward);
+
+        // FFTW transforms are unnormalized
+        for (int b = 0; b < nBlock; b++) {
+            const double* row = samples + (size_t)b * fSize;
+            float* out = output + (size_t)(first + b) * stride;
+            for (int i = 0; i < fSize; i++) {
+                out[i] = row[i] / fSize;
+            }
+        }
+    }
+    return true;
+#else
+    for (int evt = 0; evt < nEvents; evt++) {
+        if (!Filter(input + (size_t)evt * stride, output + (size_t)evt * stride, spectrum)) {
+            return false;
+        }
+    }
+    return true;
+#endif
+}
+
+} // namespace HRPPD
@@ -0,0 +1,122 @@
+#include "../include/FeatureTree.h"
+
+#include <iostream>
+#include "TFile.h"
+#include "TTree.h"
+#include "TDirectory.h"
+#include "TString.h"
+
+
+namespace HRPPD {
+
+// The float quantities of a row, in branch order
+static float EventFeatures::* const kFloatBranches[] = {
+    &EventFeatures::pedestal, &EventFeatures::rms, &EventFeatures::amp, &EventFeatures::threshold,
+    &EventFeatures::tot, &EventFeatures::triggerTime, &EventFeatures::mcpTime, &EventFeatures::npe
+};
+static const char* const kFloatBranchNames[] = {
+    "pedestal", "rms", "amp", "threshold", "tot", "triggerTime", "mcpTime", "npe"
+};
+
+FeatureWriter::FeatureWriter() {
+}
+
+FeatureWriter::~FeatureWriter() {
+    Close();
+}
+
+bool FeatureWriter::Open(const std::string& fileName) {
+    Close();
+
+    // Opening a file makes it the current directory; keep the caller's
+    TDirectory::TContext context;
+    fFile.reset(new TFile(fileName.c_str(), "RECREATE"));
+    if (!fFile || fFile->IsZombie()) {
+        std::cerr << "Error: Failed to create feature file - " << fileName << std::endl;
+        fFile.reset();
+        return false;
+    }
+
+    fFile->cd();
+    fTree = new TTree(kFeatureTreeName, "Per-event MCP features");
+    fTree->Branch("eventNum", &fRow.eventNum, "eventNum/I");
+    fTree->Branch("channel", &fRow.channel, "channel/I");
+    fTree->Branch("isSignal", &fRow.isSignal, "isSignal/O");
+    fTree->Branch("nAfterpulses", &fRow.nAfterpulses, "nAfterpulses/I");
+    for (size_t i = 0; i < sizeof(kFloatBranches) / sizeof(kFloatBranches[0]); i++) {
+        fTree->Branch(kFloatBranchNames[i], &(fRow.*kFloatBranches[i]), Form("%s/F", kFloatBranchNames[i]));
+    }
+    return true;
+}
+
+void FeatureWriter::Fill(const EventFeatures& features) {
+    if (!fTree) return;
+    fRow = features;
+    fTree->Fill();
+}
+
+void FeatureWriter::Close() {
+    if (!fFile) return;
+
+    TDirectory::TContext context(fFile.get());
+    fTree->Write();
+    fFile->Close();
+    fFile.reset();
+    fTree = nullptr;
+}
+
+FeatureReader::FeatureReader() {
+}
+
+FeatureReader::~FeatureReader() {
+    Close();
+}
+
+bool FeatureReader::Open(const std::string& fileName) {
+    Close();
+
+    TDirectory::TContext context;
+    fFile.reset(TFile::Open(fileName.c_str(), "READ"));
+    if (!fFile || fFile->IsZombie()) {
+        std::cerr << "Error: Failed to open feature file - " << fileName << std::endl;
+        fFile.reset();
+        return false;
+    }
+
+    fTree = fFile->Get<TTree>(kFeatureTreeName);
+    if (!fTree) {
+        std::cerr << "Error: No " << kFeatureTreeName << " tree in " << fileName << std::endl;
+        Close();
+        return false;
+    }
+    fTree->SetBranchAddress("eventNum", &fRow.eventNum);
+    fTree->SetBranchAddress("channel", &fRow.channel);
+    fTree->SetBranchAddress("isSignal", &fRow.isSignal);
+    // Not in feature files written before the afterpulse analysis
+    if (fTree->GetBranch("nAfterpulses")) {
+        fTree->SetBranchAddress("nAfterpulses", &fRow.nAfterpulses);
+    }
+    for (size_t i = 0; i < sizeof(kFloatBranches) / sizeof(kFloatBranches[0]); i++) {
+        fTree->SetBranchAddress(kFloatBranchNames[i], &(fRow.*kFloatBranches[i]));
+    }
+    return true;
+}
+
+long long FeatureReader::GetEntries() const {
+    return fTree ? fTree->GetEntries() : 0;
+}
+
+const EventFeatures& FeatureReader::GetEntry(long long entry) {
+    fTree->GetEntry(entry);
+    return fRow;
+}
+
+void FeatureReader::Close() {
+    if (fFile) {
+        fFile->Close();
+    }
+    fFile.reset();
+    fTree = nullptr;
+}
+
+} // namespace HRPPD
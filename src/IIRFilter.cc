@@ -0,0 +1,155 @@
+#include "../include/IIRFilter.h"
+#include "../include/CpuDispatch.h"
+
+#include <iostream>
+#include <cmath>
+
+
+namespace HRPPD {
+
+void IIRFilter::SetLowPass(float cutoffFrequency, float samplingRate) {
+    fValid = false;
+    if (cutoffFrequency <= 0. || samplingRate <= 0. || cutoffFrequency >= samplingRate / 2.) {
+        std::cerr << "Error: IIR cutoff " << cutoffFrequency << " Hz must be between 0 and Nyquist (" 
+                  << samplingRate / 2. << " Hz)" << std::endl;
+        return;
+    }
+
+    // Prewarped analog cutoff; section k carries the pole pair at angle (2k+1)pi/(2N) from the imaginary axis
+    double K = std::tan(M_PI * cutoffFrequency / samplingRate);
+    for (int k = 0; k < kSections; k++) {
+        double Q = 1. / (2. * std::sin((2 * k + 1) * M_PI / (2. * kOrder)));
+        double norm = 1. / (1. + K / Q + K * K);
+        Biquad& section = fSections[k];
+        section.b0 = K * K * norm;
+        section.b1 = 2. * K * K * norm;
+        section.b2 = K * K * norm;
+        section.a1 = 2. * (K * K - 1.) * norm;
+        section.a2 = (1. - K / Q + K * K) * norm;
+    }
+    fValid = true;
+}
+
+// Each section has unit DC gain, so a constant input x0 leaves every state at its steady
+// state z1 = (1-b0) x0, z2 = (b2-a2) x0. Starting there avoids the turn-on transient at the edges.
+
+void IIRFilter::Filter(const float* input, float* output, int n) const {
+    if (!fValid || n <= 0) return;
+
+    float z1[kSections], z2[kSections];
+
+    // Forward pass
+    for (int k = 0; k < kSections; k++) {
+        z1[k] = (1.f - fSections[k].b0) * input[0];
+        z2[k] = (fSections[k].b2 - fSections[k].a2) * input[0];
+    }
+    for (int i = 0; i < n; i++) {
+        float x = input[i];
+        for (int k = 0; k < kSections; k++) {
+            const Biquad& s = fSections[k];
+            float y = s.b0 * x + z1[k];
+            z1[k] = s.b1 * x - s.a1 * y + z2[k];
+            z2[k] = s.b2 * x - s.a2 * y;
+            x = y;
+        }
+        output[i] = x;
+    }
+
+    // Backward pass
+    for (int k = 0; k < kSections; k++) {
+        z1[k] = (1.f - fSections[k].b0) * output[n - 1];
+        z2[k] = (fSections[k].b2 - fSections[k].a2) * output[n - 1];
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        float x = output[i];
+        for (int k = 0; k < kSections; k++) {
+            const Biquad& s = fSections[k];
+            float y = s.b0 * x + z1[k];
+            z1[k] = s.b1 * x - s.a1 * y + z2[k];
+            z2[k] = s.b2 * x - s.a2 * y;
+            x = y;
+        }
+        output[i] = x;
+    }
+}
+
+#if defined(HRPPD_AVX2_KERNELS)
+// The recursion is serial in time, so the lanes run across waveforms instead:
+// lane j holds waveform evt+j. Same operations as Filter, so results are identical.
+// Returns the number of waveforms done (a multiple of 8); the caller filters the rest.
+template <class Section>
+HRPPD_AVX2_TARGET
+static int FilterBatchAVX2(const Section* sections, const float* input, float* output, int nEvents, int stride, int n) {
+    const int kSections = IIRFilter::kSections;
+    int evt = 0;
+    const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    __m256 b0[kSections], b1[kSections], b2[kSections], a1[kSections], a2[kSections];
+    __m256 init1[kSections], init2[kSections];
+    for (int k = 0; k < kSections; k++) {
+        b0[k] = _mm256_set1_ps(sections[k].b0);
+        b1[k] = _mm256_set1_ps(sections[k].b1);
+        b2[k] = _mm256_set1_ps(sections[k].b2);
+        a1[k] = _mm256_set1_ps(sections[k].a1);
+        a2[k] = _mm256_set1_ps(sections[k].a2);
+        init1[k] = _mm256_set1_ps(1.f - sections[k].b0);
+        init2[k] = _mm256_set1_ps(sections[k].b2 - sections[k].a2);
+    }
+
+    alignas(32) float lanes[8];
+    for (; evt + 8 <= nEvents; evt += 8) {
+        const float* in = input + (size_t)evt * stride;
+        float* out = output + (size_t)evt * stride;
+        __m256 z1[kSections], z2[kSections];
+
+        for (int pass = 0; pass < 2; pass++) {
+            // Forward pass reads input, backward pass reads the forward result in out
+            const float* src = (pass == 0) ? in : out;
+            int first = (pass == 0) ? 0 : n - 1;
+            int step = (pass == 0) ? 1 : -1;
+
+            __m256 x0 = _mm256_i32gather_ps(src + first, offsets, 4);
+            for (int k = 0; k < kSections; k++) {
+                z1[k] = _mm256_mul_ps(init1[k], x0);
+                z2[k] = _mm256_mul_ps(init2[k], x0);
+            }
+            for (int i = first; i >= 0 && i < n; i += step) {
+                __m256 x = _mm256_i32gather_ps(src + i, offsets, 4);
+                for (int k = 0; k < kSections; k++) {
+                    __m256 y = _mm256_add_ps(_mm256_mul_ps(b0[k], x), z1[k]);
+                    z1[k] = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1[k], x), _mm256_mul_ps(a1[k], y)), z2[k]);
+                    z2[k] = _mm256_sub_ps(_mm256_mul_ps(b2[k], x), _mm256_mul_ps(a2[k], y));
+                    x = y;
+                }
+                _mm256_store_ps(lanes, x);
+                for (int lane = 0; lane < 8; lane++) {
+                    out[(size_t)lane * stride + i] = lanes[lane];
+                }
+            }
+        }
+    }
+    return evt;
+}
+#endif
+
+bool IIRFilter::FilterBatch(const float* input, float* output, int nEvents, int stride, int n) const {
+    if (!fValid) return false;
+    if (n <= 0) return true;
+    if (stride < n) {
+        std::cerr << "Error: FilterBatch stride " << stride << " is shorter than " << n << " samples" << std::endl;
+        return false;
+    }
+
+    int evt = 0;
+#if defined(HRPPD_AVX2_KERNELS)
+    if (CpuHasAVX2()) {
+        evt = FilterBatchAVX2(fSections, input, output, nEvents, stride, n);
+    }
+#endif
+
+    for (; evt < nEvents; evt++) {
+        Filter(input + (size_t)evt * stride, output + (size_t)evt * stride, n);
+    }
+    return true;
+}
+
+} // namespace HRPPD
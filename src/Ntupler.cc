@@ -1,19 +1,30 @@
 #include "../include/Ntupler.h"
 #include "../include/Config.h"
+#include "../include/RawReader.h"
 
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <algorithm>
+#include <array>
 #include <sys/stat.h>
 #include <libgen.h>
 #include "TString.h"
+#include "TStopwatch.h"
+#include "TROOT.h"
+#include "TParameter.h"
+#include <ROOT/RNTuple.hxx>
+#include <ROOT/RNTupleModel.hxx>
 
 
 namespace HRPPD {
 
 Ntupler::Ntupler() : 
     fRawDataPath(CONFIG_RAWDATA_PATH),
-    fNtuplePath(CONFIG_NTUPLE_PATH) {
+    fNtuplePath(CONFIG_NTUPLE_PATH),
+    fThreads(CONFIG_NTUPLE_THREADS),
+    fFormat(CONFIG_NTUPLE_FORMAT),
+    fChannels(ParseChannels(CONFIG_NTUPLE_CHANNELS)) {
     // Create output directory if it doesn't exist
     if (!fNtuplePath.empty()) {
         mkdir(fNtuplePath.c_str(), 0755);
@@ -36,6 +47,16 @@ std::string Ntupler::GetPath(int runNumber, const std::string& ntuplePath) {
     return path + "/MCP_Run_" + std::to_string(runNumber) + "_ntuple.root";
 }
 
+std::string Ntupler::GetRunDir(int runNumber, const std::string& rawDataPath) {
+    std::string path = rawDataPath.empty() ? CONFIG_RAWDATA_PATH : rawDataPath;
+    if (runNumber < 136) {
+        return path + "/run" + std::to_string(runNumber);
+    } else if (runNumber >= 147 && runNumber <= 165) {
+        return path + "/1.4T Angle scan/run" + std::to_string(runNumber);
+    }
+    return path + "/Run after 135/run" + std::to_string(runNumber);
+}
+
 bool Ntupler::Convert(int runNumber, int numEvents, 
                               const std::string& dataBasePath, 
                               const std::string& ntuplePath) {
@@ -47,19 +68,17 @@ bool Ntupler::Convert(int runNumber, int numEvents,
         mkdir(fNtuplePath.c_str(), 0755);
     }
     
-    std::string runDir;
-    if (runNumber < 136) {
-        runDir = fRawDataPath + "/run" + std::to_string(runNumber);
-    } else if (runNumber >= 147 && runNumber <= 165) {
-        runDir = fRawDataPath + "/1.4T Angle scan/run" + std::to_string(runNumber);
-    } else {
-        runDir = fRawDataPath + "/Run after 135/run" + std::to_string(runNumber);
+    if (fFormat != "ttree" && fFormat != "rntuple") {
+        std::cerr << "Error: Unknown ntuple format - " << fFormat << std::endl;
+        return false;
     }
+    
+    std::string runDir = GetRunDir(runNumber, fRawDataPath);
     std::string outputFileName = GetPath(runNumber, fNtuplePath);
     
     std::cout << "== Ntuplizing Run " << runNumber << " ==" << std::endl;
     std::cout << "Data path: " << runDir << std::endl;
-    std::cout << "Output file: " << outputFileName << std::endl;
+    std::cout << "Output file: " << outputFileName << " (" << fFormat << ")" << std::endl;
     
     // Verify and create output directory
     size_t slashPos = outputFileName.find_last_of('/');
@@ -68,49 +87,17 @@ bool Ntupler::Convert(int runNumber, int numEvents,
         mkdir(dirPath.c_str(), 0755);
     }
     
-    std::unique_ptr<TFile> outFile(new TFile(outputFileName.c_str(), "RECREATE"));
-    if (!outFile || outFile->IsZombie()) {
-        std::cerr << "Error: Failed to create output file - " << outputFileName << std::endl;
-        return false;
-    }
-    
-    TTree* tree = new TTree("MCPTree", "MCP Raw Waveform Data");
-    
-    int eventNum;
-    std::vector<float> triggerWave(1024, 0.0); 
-    std::vector<std::vector<float>> mcpWaves; 
-    
-    // Initialize mcpWaves with proper size
-    mcpWaves.resize(16);
-    for (int ch = 0; ch < 16; ch++) {
-      mcpWaves[ch].resize(1024, 0.0); 
-    }
-    
-    tree->Branch("eventNumber", &eventNum, "eventNum/I");
-    tree->Branch("triggerWave", &triggerWave);
-    
-    // Create MCP channel branches (channels 0-15)
-    for (int ch = 0; ch < 16; ch++) {
-        TString branchName = Form("mcpWave%d", ch);
-        tree->Branch(branchName, &mcpWaves[ch]);
-    }
-    
-    // Open trigger file
+    // Map trigger file
     std::string triggerFile = runDir + "/TR_0_0.dat";
-    std::ifstream trigFile(triggerFile, std::ios::binary | std::ios::ate);
+    RawReader trigReader;
     
-    if (!trigFile) {
+    if (!trigReader.Open(triggerFile)) {
         std::cerr << "Error: Cannot open trigger file - " << triggerFile << std::endl;
         return false;
     }
     
     // Calculate total events
-    std::streamsize fileSize = trigFile.tellg();
-    const int binSize = sizeof(float);
-    const int binsPerEvent = 1024;
-    const int eventSize = binSize * binsPerEvent;
-    
-    int totalEvents = fileSize / eventSize;
+    int totalEvents = trigReader.GetEntries();
     std::cout << "Found " << totalEvents << " events in run " << runNumber << std::endl;
     
     // Set number of events to process
@@ -119,73 +106,181 @@ bool Ntupler::Convert(int runNumber, int numEvents,
     }
     std::cout << "Will process " << numEvents << " events" << std::endl;
     
-    // Reset file pointer
-    trigFile.seekg(0, std::ios::beg);
+    // Map the requested channel files; channels without a file are left out of the ntuple
+    std::vector<RawReader> chReaders(16);
+    std::vector<int> channels;
     
-    // Open all channel files
-    std::vector<std::ifstream> chFiles;
-    chFiles.reserve(16);
-    
-    for (int ch = 0; ch < 16; ch++) {
+    for (int ch : fChannels) {
         std::string chFileName = runDir + "/wave_" + std::to_string(ch) + ".dat";
-        chFiles.emplace_back(chFileName, std::ios::binary);
         
-        if (!chFiles[ch]) {
+        if (chReaders[ch].Open(chFileName)) {
+            channels.push_back(ch);
+        } else {
             std::cout << "Warning: Cannot open channel " << ch << " file - " << chFileName << std::endl;
-            std::cout << "Channel will be filled with zeros." << std::endl;
+            std::cout << "Channel will be omitted from the ntuple." << std::endl;
         }
     }
     
+    if (channels.empty()) {
+        std::cerr << "Error: No MCP channel to ntuplize (ntuple_channels " << CONFIG_NTUPLE_CHANNELS << ")" << std::endl;
+        return false;
+    }
+    std::cout << "Channels:";
+    for (int ch : channels) std::cout << " " << ch;
+    std::cout << std::endl;
+    
+    // With implicit MT, full TTree baskets and RNTuple pages are handed to the thread pool,
+    // so the waveform columns are compressed concurrently while events stay in order.
+    bool ownsImplicitMT = false;
+    if (fThreads > 1 && !ROOT::IsImplicitMTEnabled()) {
+        ROOT::EnableImplicitMT(fThreads);
+        ownsImplicitMT = true;
+    }
+    int nThreads = ROOT::IsImplicitMTEnabled() ? ROOT::GetThreadPoolSize() : 1;
+    std::cout << "Compression threads: " << nThreads << std::endl;
+    
+    TStopwatch timer;
+    double bytesRead = (fFormat == "rntuple") 
+        ? WriteRNTuple(outputFileName, trigReader, chReaders, channels, numEvents)
+        : WriteTTree(outputFileName, trigReader, chReaders, channels, numEvents);
+    timer.Stop();
+    
+    if (ownsImplicitMT) {
+        ROOT::DisableImplicitMT();
+    }
+    
+    if (bytesRead < 0) {
+        return false;
+    }
+    
+    double realTime = timer.RealTime();
+    if (realTime > 0) {
+        std::cout << "Throughput: " << bytesRead / 1e6 / realTime << " MB/s, "
+                  << numEvents / realTime << " events/s with " << nThreads << " thread(s) ("
+                  << realTime << " s)" << std::endl;
+    }
+    
+    std::cout << numEvents << " events processed" << std::endl;
+    std::cout << "Output file: " << outputFileName << std::endl;
+    
+    return true;
+}
+
+// Copy one event of a channel into dest (zeros if the file is missing or too short).
+// Returns the number of bytes taken from the file.
+static size_t CopyEvent(const RawReader& reader, int eventNum, float* dest) {
+    const float* data = reader.GetEvent(eventNum);
+    if (!data) {
+        std::fill(dest, dest + RawReader::kSamplesPerEvent, 0.f);
+        return 0;
+    }
+    std::copy(data, data + RawReader::kSamplesPerEvent, dest);
+    return RawReader::kEventSize;
+}
+
+double Ntupler::WriteTTree(const std::string& outputFileName, const RawReader& trigReader, 
+                           const std::vector<RawReader>& chReaders, 
+                           const std::vector<int>& channels, int numEvents) {
+    std::unique_ptr<TFile> outFile(new TFile(outputFileName.c_str(), "RECREATE"));
+    if (!outFile || outFile->IsZombie()) {
+        std::cerr << "Error: Failed to create output file - " << outputFileName << std::endl;
+        return -1;
+    }
+    
+    TTree* tree = new TTree("MCPTree", "MCP Raw Waveform Data");
+    
+    int eventNum;
+    std::vector<float> triggerWave(RawReader::kSamplesPerEvent, 0.0); 
+    std::vector<std::vector<float>> mcpWaves; 
+    
+    // Initialize mcpWaves with proper size
+    mcpWaves.resize(channels.size());
+    for (size_t i = 0; i < channels.size(); i++) {
+      mcpWaves[i].resize(RawReader::kSamplesPerEvent, 0.0); 
+    }
+    
+    // Fixed-size leaf lists: no object streaming or size headers per entry, and
+    // the branches qualify for the bulk read path used by DataIO.
+    // Baskets hold 64 events so each bulk read deserializes a sizeable block.
+    const int basketSize = 64 * RawReader::kEventSize;
+    tree->Branch("eventNumber", &eventNum, "eventNum/I");
+    tree->Branch("triggerWave", triggerWave.data(), 
+                 Form("triggerWave[%d]/F", RawReader::kSamplesPerEvent), basketSize);
+    
+    // Create MCP channel branches (selected channels only)
+    for (size_t i = 0; i < channels.size(); i++) {
+        TString branchName = Form("mcpWave%d", channels[i]);
+        tree->Branch(branchName, mcpWaves[i].data(), 
+                     Form("mcpWave%d[%d]/F", channels[i], RawReader::kSamplesPerEvent), basketSize);
+    }
+    tree->GetUserInfo()->Add(new TParameter<int>("schemaVersion", kSchemaVersion));
+    
+    double bytesRead = 0.;
+    
     // Process events
     for (eventNum = 0; eventNum < numEvents; eventNum++) {
         if (eventNum % 1000 == 0) {
             std::cout << "Processing event: " << eventNum << "/" << numEvents << std::endl;
         }
         
-        // Read trigger waveform data
-        triggerWave.clear();
-        triggerWave.resize(1024);
-        for (int bin = 0; bin < 1024; bin++) {
-            float value;
-            trigFile.read((char*)&value, sizeof(float));
-            triggerWave[bin] = value;
-        }
-        
-        // Read MCP channel waveform data
-        for (int ch = 0; ch < 16; ch++) {
-            mcpWaves[ch].clear();
-            mcpWaves[ch].resize(1024);
-            
-            if (chFiles[ch]) {
-                for (int bin = 0; bin < 1024; bin++) {
-                    float value;
-                    chFiles[ch].read((char*)&value, sizeof(float));
-                    mcpWaves[ch][bin] = value;
-                }
-            } else {
-                // Fill with zeros if file cannot be opened
-                for (int bin = 0; bin < 1024; bin++) {
-                    mcpWaves[ch][bin] = 0.0;
-                }
-            }
+        // Copy waveforms straight from the mappings into the branch buffers
+        bytesRead += CopyEvent(trigReader, eventNum, triggerWave.data());
+        for (size_t i = 0; i < channels.size(); i++) {
+            bytesRead += CopyEvent(chReaders[channels[i]], eventNum, mcpWaves[i].data());
         }
         tree->Fill();
     }
     
-    trigFile.close();
-    for (auto& file : chFiles) {
-        if (file.is_open()) {
-            file.close();
-        }
-    }
-    
     outFile->cd();
     tree->Write();
     
-    std::cout << numEvents << " events processed" << std::endl;
-    std::cout << "Output file: " << outputFileName << std::endl;
+    return bytesRead;
+}
+
+double Ntupler::WriteRNTuple(const std::string& outputFileName, const RawReader& trigReader, 
+                             const std::vector<RawReader>& chReaders, 
+                             const std::vector<int>& channels, int numEvents) {
+    using ROOT::Experimental::RNTupleModel;
+    using ROOT::Experimental::RNTupleWriter;
+    using Waveform = std::array<float, RawReader::kSamplesPerEvent>;
     
-    return true;
+    // Same field names as the MCPTree branches; every waveform is a fixed-length float column
+    auto model = RNTupleModel::Create();
+    auto eventNum = model->MakeField<int>("eventNumber");
+    auto triggerWave = model->MakeField<Waveform>("triggerWave");
+    std::vector<std::shared_ptr<Waveform>> mcpWaves;
+    for (int ch : channels) {
+        mcpWaves.push_back(model->MakeField<Waveform>(Form("mcpWave%d", ch)));
+    }
+    
+    std::unique_ptr<RNTupleWriter> writer;
+    try {
+        writer = RNTupleWriter::Recreate(std::move(model), "MCPTree", outputFileName);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Failed to create output file - " << outputFileName << " (" << e.what() << ")" << std::endl;
+        return -1;
+    }
+    
+    double bytesRead = 0.;
+    
+    // Process events
+    for (int evt = 0; evt < numEvents; evt++) {
+        if (evt % 1000 == 0) {
+            std::cout << "Processing event: " << evt << "/" << numEvents << std::endl;
+        }
+        
+        *eventNum = evt;
+        bytesRead += CopyEvent(trigReader, evt, triggerWave->data());
+        for (size_t i = 0; i < channels.size(); i++) {
+            bytesRead += CopyEvent(chReaders[channels[i]], evt, mcpWaves[i]->data());
+        }
+        writer->Fill();
+    }
+    
+    // Destroying the writer commits the last cluster and the footer
+    writer.reset();
+    
+    return bytesRead;
 }
 
 } // namespace HRPPD 
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "../include/PersistenceHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include "TH2F.h"
+
+
+namespace HRPPD {
+
+PersistenceHistogram::PersistenceHistogram(int nTimeBins, double timeMin, double timeMax,
+                                           int nAmpBins, double ampMin, double ampMax) :
+    fNTimeBins(nTimeBins), fTimeMin(timeMin), fTimeMax(timeMax),
+    fNAmpBins(nAmpBins), fAmpMin(ampMin), fAmpMax(ampMax),
+    fScale(nAmpBins / (ampMax - ampMin)),
+    fOffset(-ampMin * nAmpBins / (ampMax - ampMin)),
+    fCounts((size_t)nTimeBins * (nAmpBins + 2), 0),
+    fBins(nTimeBins) {
+}
+
+void PersistenceHistogram::Fill(const float* samples, int nSamples) {
+    int n = std::min(nSamples, fNTimeBins);
+    if (n <= 0) return;
+
+    // Amplitude bin of every sample in one vectorizable pass: clamping to [-1, nAmpBins]
+    // before the floor puts out-of-range samples in the underflow (0) and overflow rows
+    const float scale = fScale;
+    const float offset = fOffset;
+    const float upper = fNAmpBins;
+    int* bins = fBins.data();
+    for (int i = 0; i < n; i++) {
+        float x = std::min(std::max(samples[i] * scale + offset, -1.f), upper);
+        bins[i] = (int)std::floor(x) + 1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        size_t index = Index(i, bins[i]);
+        if (++fCounts[index] == 0) {
+            fCarry[index] += 65536;
+        }
+    }
+    fEntries += n;
+}
+
+bool PersistenceHistogram::Add(const PersistenceHistogram& other) {
+    if (other.fNTimeBins != fNTimeBins || other.fNAmpBins != fNAmpBins) {
+        return false;
+    }
+
+    // Widen, add and keep the low 16 bits; the vector loop only flags that some cell wrapped
+    uint16_t* counts = fCounts.data();
+    const uint16_t* otherCounts = other.fCounts.data();
+    const size_t size = fCounts.size();
+    bool wrapped = false;
+    for (size_t i = 0; i < size; i++) {
+        uint32_t sum = (uint32_t)counts[i] + otherCounts[i];
+        wrapped |= (sum > 0xFFFF);
+        counts[i] = (uint16_t)sum;
+    }
+    if (wrapped) {
+        for (size_t i = 0; i < size; i++) {
+            if (counts[i] < otherCounts[i]) {
+                fCarry[i] += 65536;
+            }
+        }
+    }
+
+    for (const auto& carry : other.fCarry) {
+        fCarry[carry.first] += carry.second;
+    }
+    fEntries += other.fEntries;
+    return true;
+}
+
+uint64_t PersistenceHistogram::GetCount(int timeBin, int ampBin) const {
+    size_t index = Index(timeBin, ampBin);
+    auto carry = fCarry.find(index);
+    return fCounts[index] + (carry != fCarry.end() ? carry->second : 0);
+}
+
+TH2F* PersistenceHistogram::MakeHistogram(const char* name, const char* title) const {
+    TH2F* hist = new TH2F(name, title, fNTimeBins, fTimeMin, fTimeMax, fNAmpBins, fAmpMin, fAmpMax);
+    hist->SetDirectory(nullptr);
+
+    for (int t = 0; t < fNTimeBins; t++) {
+        for (int a = 0; a <= fNAmpBins + 1; a++) {
+            uint64_t count = GetCount(t, a);
+            if (count > 0) {
+                hist->SetBinContent(t + 1, a, count);
+            }
+        }
+    }
+    hist->ResetStats();
+    hist->SetEntries(fEntries);
+    return hist;
+}
+
+} // namespace HRPPD
@@ -0,0 +1,127 @@
+#include "../include/Provenance.h"
+#include "../include/RunAnalyzer.h"
+#include "../include/Config.h"
+#include "../include/Ntupler.h"
+
+#include <iostream>
+#include <sstream>
+#include <memory>
+#include <set>
+#include <sys/stat.h>
+#include "TFile.h"
+#include "TNamed.h"
+#include "TDirectory.h"
+#include "TSystem.h"
+#include "TString.h"
+
+// Written by CMake from `git describe` on every build (cmake/Version.cmake)
+#if __has_include("HRPPDVersion.h")
+#include "HRPPDVersion.h"
+#endif
+#ifndef HRPPD_VERSION
+#define HRPPD_VERSION "unknown"
+#endif
+
+
+namespace HRPPD {
+
+void Provenance::Add(const std::string& key, const std::string& value) {
+    fText += key + " " + value + "\n";
+}
+
+void Provenance::AddFile(const std::string& key, const std::string& path) {
+    Add(key, DescribeFile(path));
+}
+
+std::string Provenance::DescribeFile(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return path + " missing";
+    }
+    return path + " size " + std::to_string((long long)st.st_size) + " mtime " + std::to_string((long long)st.st_mtime);
+}
+
+std::string Provenance::Read(const std::string& fileName) {
+    // AccessPathName is true when the file does not exist
+    if (gSystem->AccessPathName(fileName.c_str())) {
+        return "";
+    }
+
+    TDirectory::TContext context;
+    std::unique_ptr<TFile> file(TFile::Open(fileName.c_str(), "READ"));
+    if (!file || file->IsZombie()) {
+        return "";
+    }
+    std::unique_ptr<TNamed> provenance(file->Get<TNamed>(kProvenanceName));
+    return provenance ? provenance->GetTitle() : "";
+}
+
+std::string Provenance::Diff(const std::string& oldText, const std::string& newText, int maxLines) {
+    auto lines = [](const std::string& text) {
+        std::multiset<std::string> result;
+        std::istringstream stream(text);
+        std::string line;
+        while (std::getline(stream, line)) {
+            result.insert(line);
+        }
+        return result;
+    };
+    std::multiset<std::string> oldLines = lines(oldText);
+    std::multiset<std::string> newLines = lines(newText);
+
+    std::string diff;
+    int nLines = 0;
+    for (const auto& side : {std::make_pair("- ", &oldLines), std::make_pair("+ ", &newLines)}) {
+        const std::multiset<std::string>& other = (side.second == &oldLines) ? newLines : oldLines;
+        for (const std::string& line : *side.second) {
+            if (other.count(line)) continue;
+            if (nLines++ < maxLines) {
+                diff += side.first + line + "\n";
+            }
+        }
+    }
+    if (nLines > maxLines) {
+        diff += "  (" + std::to_string(nLines - maxLines) + " more)\n";
+    }
+    return diff;
+}
+
+const char* Provenance::GetLibraryVersion() {
+    return HRPPD_VERSION;
+}
+
+Provenance Provenance::ForRun(int runNumber, const std::vector<int>& channels, int maxEvents,
+                              const AnalysisOptions& analysis, const std::string& source) {
+    std::string channelList;
+    for (size_t i = 0; i < channels.size(); i++) {
+        channelList += (i > 0 ? "," : "") + std::to_string(channels[i]);
+    }
+
+    Provenance provenance;
+    provenance.Add("version", GetLibraryVersion());
+    provenance.Add("run", std::to_string(runNumber));
+    provenance.Add("channels", channelList);
+    provenance.Add("max_events", std::to_string(maxEvents));
+    provenance.Add("analyses", Form("waveform %d waveform2D %d tot %d timing %d amplitude %d npe %d afterpulse %d features %d",
+                                    analysis.doWaveform, analysis.doWaveform2D, analysis.doToT, analysis.doTiming,
+                                    analysis.doAmplitude, analysis.doNpe, analysis.doAfterpulse, !analysis.featureFile.empty()));
+    provenance.Add("source", source);
+    if (source == "raw") {
+        std::string runDir = Ntupler::GetRunDir(runNumber, CONFIG_RAWDATA_PATH);
+        provenance.AddFile("input", runDir + "/TR_0_0.dat");
+        for (int channel : channels) {
+            provenance.AddFile("input", runDir + "/wave_" + std::to_string(channel) + ".dat");
+        }
+    } else {
+        provenance.AddFile("input", Ntupler::GetPath(runNumber, CONFIG_NTUPLE_PATH));
+    }
+
+    std::istringstream config(GetConfigText());
+    std::string line;
+    while (std::getline(config, line)) {
+        provenance.Add("config", line);
+    }
+    return provenance;
+}
+
+} // namespace HRPPD
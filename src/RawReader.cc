@@ -0,0 +1,100 @@
+#include "../include/RawReader.h"
+
+#include <iostream>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace HRPPD {
+
+RawReader::RawReader() {
+}
+
+RawReader::RawReader(const std::string& fileName) {
+    Open(fileName);
+}
+
+RawReader::~RawReader() {
+    Close();
+}
+
+RawReader::RawReader(RawReader&& other) noexcept :
+    fFileName(std::move(other.fFileName)),
+    fData(other.fData), fSize(other.fSize), fEntries(other.fEntries) {
+    other.fData = nullptr;
+    other.fSize = 0;
+    other.fEntries = 0;
+}
+
+RawReader& RawReader::operator=(RawReader&& other) noexcept {
+    if (this != &other) {
+        Close();
+        fFileName = std::move(other.fFileName);
+        fData = other.fData;
+        fSize = other.fSize;
+        fEntries = other.fEntries;
+        other.fData = nullptr;
+        other.fSize = 0;
+        other.fEntries = 0;
+    }
+    return *this;
+}
+
+bool RawReader::Open(const std::string& fileName) {
+    Close();
+    fFileName = fileName;
+
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    if (data == MAP_FAILED) {
+        std::cerr << "Error: Failed to map file - " << fileName << std::endl;
+        return false;
+    }
+
+    // Events are consumed front to back; let the kernel read ahead aggressively
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    fData = static_cast<const char*>(data);
+    fSize = st.st_size;
+    fEntries = fSize / kEventSize;
+
+    if (fSize % kEventSize != 0) {
+        std::cout << "Warning: " << fileName << " has a truncated last event ("
+                  << fSize % kEventSize << " trailing bytes ignored)" << std::endl;
+    }
+
+    return true;
+}
+
+void RawReader::Close() {
+    if (fData) {
+        munmap(const_cast<char*>(fData), fSize);
+        fData = nullptr;
+    }
+    fSize = 0;
+    fEntries = 0;
+}
+
+const float* RawReader::GetEvent(int eventIndex) const {
+    if (!fData || eventIndex < 0 || eventIndex >= fEntries) {
+        return nullptr;
+    }
+    return reinterpret_cast<const float*>(fData + eventIndex * kEventSize);
+}
+
+} // namespace HRPPD
@@ -0,0 +1,1121 @@
+#include "../include/RunAnalyzer.h"
+#include "../include/DataIO.h"
+#include "../include/WaveformProcessor.h"
+#include "../include/EventAnalyzer.h"
+#include "../include/FFTFilterEngine.h"
+#include "../include/CFDVisualizer.h"
+#include "../include/RawReader.h"
+#include "../include/Config.h"
+#include "../include/BoundedQueue.h"
+#include "../include/FeatureTree.h"
+#include "../include/WaveformSnapshot.h"
+#include "../include/AfterpulseFinder.h"
+#include "../include/PersistenceHistogram.h"
+#include "../include/SignalIndex.h"
+#include "../include/Provenance.h"
+#include "../include/WorkStealingPool.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include "TH1F.h"
+#include "TH2F.h"
+#include "TH1D.h"
+#include "TString.h"
+#include "TDirectory.h"
+#include "TStopwatch.h"
+#include "TROOT.h"
+#include "TParameter.h"
+
+
+namespace HRPPD {
+
+// Events are corrected (and filtered) in batches; corrected waveforms are stored back-to-back,
+// kBatchSize slots of RawReader::kSamplesPerEvent samples, reused across batches
+static const int kBatchSize = 256;
+static const int kStride = RawReader::kSamplesPerEvent;
+
+// Binning of the 2D waveform histograms: one time bin per sample (0.2 ns) over 200 ns, 0.5 mV
+static PersistenceHistogram* NewPersistence() {
+    return new PersistenceHistogram(1000, 0., 200., 4000, -1000., 1000.);
+}
+
+// Features of one event in one channel: the histogram fills of a signal event and a row of the feature tree
+struct RunAnalyzer::EventRecord {
+    int channelIndex;
+    EventFeatures features;
+};
+
+// Corrected waveforms (first WaveformSnapshot::kSamples samples) of one signal event for the snapshot tree
+struct RunAnalyzer::WaveformDump {
+    int eventNum;
+    int channelIndex;
+    std::vector<float> trig;
+    std::vector<float> mcp;
+};
+
+// Output of one entry range, handed from the worker to the merging thread
+struct RunAnalyzer::ChunkResult {
+    int first = 0;
+    int last = 0;
+    bool done = false;
+    int unread = 0;                       // Entries GetEvent could not read
+    std::vector<EventRecord> records;     // Signal events, or all events when the feature tree is written
+    std::vector<WaveformDump> dumps;
+    std::vector<int> dumpCounts;          // [channel] dumps taken in this chunk
+    std::vector<std::vector<PowerSpectrum>> spectra;    // [channel][batch] unfiltered MCP spectra
+    std::vector<std::pair<int, float>> afterpulseDelays; // (channel index, delay in ns) of each afterpulse
+};
+
+// Results of one MCP channel. The histograms belong to the output file.
+struct RunAnalyzer::ChannelOutput {
+    int channel;
+    std::string dir;            // Output directory, "" (top level) when a single channel is analysed
+    std::unique_ptr<PersistenceHistogram> trig2D;   // Sum of the workers' 2D waveform histograms
+    std::unique_ptr<PersistenceHistogram> mcp2D;
+    TH2F* hToT = nullptr;
+    TH1F* hTrigTiming = nullptr;
+    TH1F* hMCPTiming = nullptr;
+    TH1F* hDiffTiming = nullptr;
+    TH1F* hAmp = nullptr;
+    TH1F* hNpe = nullptr;
+    TH1F* hAfterpulseDelay = nullptr;
+    TH1F* hAfterpulseCount = nullptr;
+    long afterpulseEvents = 0;  // Signal events with at least one afterpulse
+    long afterpulses = 0;
+    CFDVisualizer trigCFDVisualizer;
+    CFDVisualizer mcpCFDVisualizer;
+    std::atomic<int> snapshots{0};  // Waveform snapshots stored so far (written by the merge, read by the workers)
+    PowerSpectrum spectrum;     // Average MCP power spectrum, accumulated while filtering (filter_mode fft only)
+
+    ChannelOutput(int channel, const std::string& dir, int runNumber) :
+        channel(channel), dir(dir),
+        trigCFDVisualizer(Path("CFD_Trig"), CONFIG_CFD_VISUALIZE_EVENTS, runNumber),
+        mcpCFDVisualizer(Path("CFD_MCP"), CONFIG_CFD_VISUALIZE_EVENTS, runNumber),
+        spectrum(WaveformProcessor::kFFTSize) {
+    }
+
+    std::string Path(const std::string& name) const {
+        return dir.empty() ? name : dir + "/" + name;
+    }
+};
+
+namespace {
+    // Per-channel part of a worker: corrected MCP batch, 2D histograms and CFD samples
+    struct WorkerChannel {
+        std::unique_ptr<PersistenceHistogram> trig2D;
+        std::unique_ptr<PersistenceHistogram> mcp2D;
+        CFDVisualizer trigCFDVisualizer;
+        CFDVisualizer mcpCFDVisualizer;
+        std::vector<float> mcpBatch;
+        std::vector<int> mcpSize;
+        std::vector<WaveformStats> mcpStats;
+        std::vector<char> mcpSelected;      // Passed the preselection, so fully corrected
+
+        explicit WorkerChannel(int runNumber) :
+            trigCFDVisualizer("CFD_Trig", CONFIG_CFD_VISUALIZE_EVENTS, runNumber),
+            mcpCFDVisualizer("CFD_MCP", CONFIG_CFD_VISUALIZE_EVENTS, runNumber),
+            mcpBatch(kBatchSize * kStride), mcpSize(kBatchSize), mcpStats(kBatchSize), mcpSelected(kBatchSize) {
+        }
+    };
+
+    // Preselection counters of a worker, summed over the workers for the run summary
+    struct PreselectionStats {
+        long long events = 0;
+        long long rejectedEvents = 0;       // No channel passed: nothing corrected
+        long long mcpWaveforms = 0;
+        long long rejectedWaveforms = 0;    // MCP waveforms not corrected
+        long long correctedWaveforms = 0;   // Trigger and MCP waveforms fully corrected
+        double preselectSeconds = 0.;
+        double correctSeconds = 0.;
+
+        void Add(const PreselectionStats& other) {
+            events += other.events;
+            rejectedEvents += other.rejectedEvents;
+            mcpWaveforms += other.mcpWaveforms;
+            rejectedWaveforms += other.rejectedWaveforms;
+            correctedWaveforms += other.correctedWaveforms;
+            preselectSeconds += other.preselectSeconds;
+            correctSeconds += other.correctSeconds;
+        }
+    };
+}
+
+// Per-thread analysis state. The 2D waveform histograms and CFD samples are only summed,
+// so each worker keeps its own for the whole run and they are merged once at the end.
+struct RunAnalyzer::Worker {
+    DataIO dataIO;
+    WaveformProcessor processor;
+    EventAnalyzer analyzer;
+    AfterpulseFinder afterpulseFinder;
+    std::vector<std::unique_ptr<WorkerChannel>> channels;
+    std::vector<Pulse> pulses;              // Scratch: afterpulses of one waveform
+
+    std::vector<float> trigBatch;
+    std::vector<int> batchEvents;
+    std::vector<int> trigSize;
+    std::vector<WaveformView> mcpWaves;     // Raw MCP waveforms of the event being corrected
+    std::vector<int> entries;               // Scratch: entries of the chunk being processed
+
+    PreselectionStats preselection;
+
+    Worker(int nChannels, int runNumber) :
+        trigBatch(kBatchSize * kStride), batchEvents(kBatchSize), trigSize(kBatchSize), mcpWaves(nChannels) {
+        for (int c = 0; c < nChannels; c++) {
+            channels.emplace_back(new WorkerChannel(runNumber));
+        }
+    }
+};
+
+// Analysis parameters from the configuration
+static void Configure(WaveformProcessor& processor, EventAnalyzer& analyzer, AfterpulseFinder& afterpulseFinder) {
+    for (WaveformProcessor* p : {&processor, &analyzer.fProcessor}) {
+        p->fCalibrationConstant = CONFIG_CALIBRATION_CONSTANT;
+        p->fDeltaT = CONFIG_DELTA_T;
+        p->fSamplingRate = CONFIG_SAMPLING_RATE;
+        p->fFilterMode = CONFIG_FILTER_MODE;
+    }
+    analyzer.fTriggerCfdFraction = CONFIG_TRIGGER_CFD_FRACTION;
+    analyzer.fTriggerCfdDelay = CONFIG_TRIGGER_CFD_DELAY;
+    analyzer.fMcpCfdFraction = CONFIG_MCP_CFD_FRACTION;
+    analyzer.fMcpCfdDelay = CONFIG_MCP_CFD_DELAY;
+    analyzer.fTriggerWindowMin = CONFIG_TRIGGER_WINDOW_MIN;
+    analyzer.fTriggerWindowMax = CONFIG_TRIGGER_WINDOW_MAX;
+    analyzer.fMcpWindowMin = CONFIG_MCP_WINDOW_MIN;
+    analyzer.fMcpWindowMax = CONFIG_MCP_WINDOW_MAX;
+    analyzer.fFftCutoffFrequency = CONFIG_FFT_CUTOFF_FREQUENCY;
+    analyzer.fApplyFFTFilter = CONFIG_APPLY_FFT_FILTER;
+    afterpulseFinder.fWindowMin = CONFIG_AFTERPULSE_WINDOW_MIN;
+    afterpulseFinder.fWindowMax = CONFIG_AFTERPULSE_WINDOW_MAX;
+    afterpulseFinder.fMinToT = CONFIG_AFTERPULSE_MIN_TOT;
+    afterpulseFinder.fDeltaT = CONFIG_DELTA_T;
+}
+
+// Everything the signal selection of AnalyzeBatch depends on, as the key of the signal index:
+// the input files (size and modification time, as in the provenance) and the selection parameters.
+// The version changes with the selection code.
+static std::string SelectionKey(int channel, int nEntries, const std::vector<std::string>& inputFiles) {
+    std::string key = Form("selection v2: channel %d, %d entries, MCP window %d-%d, amplitude > 4 rms, ToT > 800 ps, delta_t %.9g ps, calibration %.9g",
+                           channel, nEntries, CONFIG_MCP_WINDOW_MIN, CONFIG_MCP_WINDOW_MAX, CONFIG_DELTA_T, CONFIG_CALIBRATION_CONSTANT);
+    if (CONFIG_APPLY_FFT_FILTER) {
+        key += Form(", %s filter %.9g Hz at %.9g Hz", CONFIG_FILTER_MODE.c_str(), CONFIG_FFT_CUTOFF_FREQUENCY, CONFIG_SAMPLING_RATE);
+    }
+    for (const std::string& file : inputFiles) {
+        key += ", input " + Provenance::DescribeFile(file);
+    }
+    return key;
+}
+
+namespace {
+    // Raw waveforms of up to kBatchSize consecutive entries, filled by the pipeline's reader.
+    // MCP samples and sizes are stored channel after channel.
+    struct EventBatch {
+        int first = 0;
+        int last = 0;
+        int nEvents = 0;
+        int unread = 0;     // Entries GetEvent could not read
+        std::vector<float> trig;
+        std::vector<float> mcp;
+        std::vector<int> events;
+        std::vector<int> trigSize;
+        std::vector<int> mcpSize;
+
+        explicit EventBatch(int nChannels) :
+            trig(kBatchSize * kStride), mcp(nChannels * kBatchSize * kStride),
+            events(kBatchSize), trigSize(kBatchSize), mcpSize(nChannels * kBatchSize) {
+        }
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    double Seconds(Clock::time_point since) {
+        return std::chrono::duration<double>(Clock::now() - since).count();
+    }
+
+    // Time a pipeline stage spends working, waiting for input and blocked by the next stage
+    struct StageClock {
+        double busy = 0.;
+        double waitInput = 0.;
+        double waitOutput = 0.;
+    };
+
+    // Spin briefly, then sleep, so waiting stages leave the cores to the compute pool
+    void Backoff(int spin) {
+        if (spin < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    // Retry a queue operation until it succeeds, adding the time spent to waited
+    template <class F>
+    void WaitFor(F tryOp, double& waited) {
+        if (tryOp()) return;
+        Clock::time_point start = Clock::now();
+        for (int spin = 0; !tryOp(); spin++) {
+            Backoff(spin);
+        }
+        waited += Seconds(start);
+    }
+}
+
+RunAnalyzer::RunAnalyzer(const AnalysisOptions& options) :
+    fOptions(options) {
+}
+
+RunAnalyzer::~RunAnalyzer() {
+}
+
+void RunAnalyzer::CreateHistograms(DataIO& dataIO, ChannelOutput& output) {
+    // Created in the channel's directory of the output file, which owns them
+    TDirectory::TContext context(dataIO.GetDir(output.dir));
+
+    if (fOptions.doToT) {
+        output.hToT = new TH2F("ToT", "ToT;Amplitude [mV];Time [ps]", 100, 0., 60., 40, 0., 8000.);
+    }
+
+    // Timing histograms
+    if (fOptions.doTiming) {
+        output.hTrigTiming = new TH1F("Timing_Trig", "Trigger Timing;Time [ps];Counts", 1000, 0., 120000.);
+        output.hMCPTiming = new TH1F("Timing_MCP", "MCP Timing;Time [ps];Counts", 1000, 20000., 240000.);
+        output.hDiffTiming = new TH1F("Timing_Diff", "Timing Resolution;Time [ps];Counts", 1000, 50000., 80000.);
+    }
+
+    // Amplitude histogram
+    if (fOptions.doAmplitude) {
+        output.hAmp = new TH1F("Amplitude", "MCP Amplitude;Amplitude [mV];Counts", 1000, 0., 100.);
+    }
+
+    // Npe histogram
+    if (fOptions.doNpe) {
+        output.hNpe = new TH1F("Npe", "Number of Photoelectrons;Npe;Counts", 1000, 0., 15000000.);
+    }
+
+    // Afterpulse histograms
+    if (fOptions.doAfterpulse) {
+        output.hAfterpulseDelay = new TH1F("Afterpulse_Delay", "Afterpulse Delay;Delay [ns];Counts", 240, 0., 120.);
+        output.hAfterpulseCount = new TH1F("Afterpulse_Multiplicity", "Afterpulses per Signal Event;Afterpulses;Events", 10, -0.5, 9.5);
+    }
+}
+
+void RunAnalyzer::WriteAfterpulseSummary(DataIO& dataIO, const ChannelOutput& output) const {
+    if (!output.hAfterpulseCount) return;
+
+    long signalEvents = output.hAfterpulseCount->GetEntries();
+    double ratio = (signalEvents > 0) ? 100. * output.afterpulseEvents / signalEvents : 0.;
+    double perEvent = (signalEvents > 0) ? (double)output.afterpulses / signalEvents : 0.;
+    std::cout << Form("Ch %d afterpulses: %ld of %ld signal events (%.2f%%), %ld pulses (%.3f per event)",
+                      output.channel, output.afterpulseEvents, signalEvents, ratio, output.afterpulses, perEvent) << std::endl;
+
+    TParameter<Long64_t> nSignal("Afterpulse_SignalEvents", signalEvents);
+    TParameter<Long64_t> nEvents("Afterpulse_Events", output.afterpulseEvents);
+    TParameter<Long64_t> nPulses("Afterpulse_Pulses", output.afterpulses);
+    TParameter<double> ratioParameter("Afterpulse_Ratio", ratio);
+    for (TObject* parameter : {(TObject*)&nSignal, (TObject*)&nEvents, (TObject*)&nPulses, (TObject*)&ratioParameter}) {
+        dataIO.Save(parameter, output.dir);
+    }
+}
+
+bool RunAnalyzer::Run(DataIO& dataIO, int runNumber, int maxEvents) {
+    if (!Begin(dataIO, runNumber, maxEvents)) {
+        return false;
+    }
+
+    const int nThreads = fWorkers.size();
+    if (fOptions.pipeline) {
+        if (!RunPipeline(dataIO, fWorkers, fRanges)) {
+            return false;
+        }
+    } else if (nThreads == 1) {
+        for (int chunk = 0; chunk < GetNChunks(); chunk++) {
+            ProcessChunk(chunk);
+        }
+    } else {
+        // Chunks queued from this thread are taken in entry order by the pool threads; whichever
+        // completes the next one writes it, as in the batch driver
+        WorkStealingPool pool(nThreads);
+        for (int chunk = 0; chunk < GetNChunks(); chunk++) {
+            pool.Submit([this, chunk] { ProcessChunk(chunk); });
+        }
+        pool.Wait();
+    }
+
+    return Finish();
+}
+
+RunAnalyzer::Worker* RunAnalyzer::AddWorker(bool openInput) {
+    const int nChannels = fOutputs.size();
+    std::unique_ptr<Worker> worker(new Worker(nChannels, fRunNumber));
+    Configure(worker->processor, worker->analyzer, worker->afterpulseFinder);
+    worker->analyzer.Init();
+    if (openInput && !worker->dataIO.OpenInput(*fDataIO)) {
+        std::cerr << "Error: Worker " << fWorkers.size() << " cannot open the input of Run " << fRunNumber << std::endl;
+        return nullptr;
+    }
+    if (fOptions.doWaveform2D) {
+        for (int c = 0; c < nChannels; c++) {
+            WorkerChannel& channel = *worker->channels[c];
+            channel.trig2D.reset(NewPersistence());
+            channel.mcp2D.reset(NewPersistence());
+        }
+    }
+    fWorkers.push_back(std::move(worker));
+    return fWorkers.back().get();
+}
+
+bool RunAnalyzer::Begin(DataIO& dataIO, int runNumber, int maxEvents) {
+    fRunNumber = runNumber;
+    fDataIO = &dataIO;
+    fStart = std::chrono::steady_clock::now();
+
+    // One directory per channel when several are analysed, the flat layout otherwise
+    const std::vector<int>& channels = dataIO.GetChannels();
+    const int nChannels = channels.size();
+    fOutputs.clear();
+    for (int channel : channels) {
+        fOutputs.emplace_back(new ChannelOutput(channel, nChannels > 1 ? Form("Ch%d", channel) : "", fRunNumber));
+        ChannelOutput& output = *fOutputs.back();
+        if (fOptions.doWaveform) {
+            dataIO.SetDir(output.Path("CFD_Trig"));
+            dataIO.SetDir(output.Path("CFD_MCP"));
+        }
+        CreateHistograms(dataIO, output);
+    }
+
+    int totalEvents = dataIO.GetEntries();
+    fProcessEvents = (maxEvents < 0) ? totalEvents : std::min(maxEvents, totalEvents);
+    fRanges = dataIO.GetClusterRanges(fProcessEvents);
+
+    // Signal index: a pass that needs only the signal events reads the cached entries of an
+    // earlier pass with the same selection; otherwise a full pass records them
+    fSelectionKeys.clear();
+    fUseIndex = false;
+    fIndexEntries.clear();
+    fSignalIndex.reset();
+    if (!fOptions.signalIndexFile.empty()) {
+        std::vector<std::string> inputFiles = dataIO.GetInputFiles();
+        for (int channel : channels) {
+            fSelectionKeys.push_back(SelectionKey(channel, totalEvents, inputFiles));
+        }
+        // The feature tree and the filter's power spectrum take every event
+        bool needAll = !fOptions.featureFile.empty() || CONFIG_APPLY_FFT_FILTER;
+        SignalIndex index;
+        if (!needAll && index.Load(fOptions.signalIndexFile, channels, fSelectionKeys)) {
+            fIndexEntries = index.GetUnion();
+            fIndexEntries.erase(std::lower_bound(fIndexEntries.begin(), fIndexEntries.end(), fProcessEvents), fIndexEntries.end());
+            fUseIndex = true;
+
+            // Clusters without a signal entry are not read at all
+            size_t nClusters = fRanges.size();
+            std::vector<std::pair<int, int>> signalRanges;
+            for (const auto& range : fRanges) {
+                auto it = std::lower_bound(fIndexEntries.begin(), fIndexEntries.end(), range.first);
+                if (it != fIndexEntries.end() && *it < range.second) {
+                    signalRanges.push_back(range);
+                }
+            }
+            fRanges.swap(signalRanges);
+            std::cout << Form("Signal index: reading %zu of %d entries (%.1f%%) in %zu of %zu clusters",
+                              fIndexEntries.size(), fProcessEvents, fProcessEvents > 0 ? 100. * fIndexEntries.size() / fProcessEvents : 0.,
+                              fRanges.size(), nClusters) << std::endl;
+        } else if (fProcessEvents == totalEvents) {
+            fSignalIndex.reset(new SignalIndex());
+            fSignalIndex->Reset(nChannels);
+        }
+    }
+
+    int nThreads = std::max(1, fOptions.pipeline ? fOptions.threads : std::min<int>(fOptions.threads, fRanges.size()));
+
+    if (fOptions.pipeline) {
+        std::cout << "Processing " << fProcessEvents << " events of " << nChannels << " channel(s) in a pipeline with "
+                  << nThreads << " compute thread(s)..." << std::endl;
+    } else {
+        std::cout << "Processing " << fProcessEvents << " events of " << nChannels << " channel(s) in "
+                  << fRanges.size() << " chunks with " << nThreads << " thread(s)..." << std::endl;
+    }
+
+    if (nThreads > 1 || fOptions.pipeline) {
+        ROOT::EnableThreadSafety();
+    }
+
+    // Workers are set up here, so no ROOT object is created or registered in a worker thread.
+    // Their number bounds the memory of the run: each holds 2D waveform histograms per channel.
+    fWorkers.clear();
+    fIdleWorkers.clear();
+    for (int i = 0; i < nThreads; i++) {
+        // Pipeline workers are fed by the reader thread
+        Worker* worker = AddWorker(!fOptions.pipeline);
+        if (!worker) {
+            return false;
+        }
+        fIdleWorkers.push_back(worker);
+    }
+
+    fResults = std::vector<ChunkResult>(fRanges.size());
+    for (size_t i = 0; i < fRanges.size(); i++) {
+        fResults[i].first = fRanges[i].first;
+        fResults[i].last = fRanges[i].second;
+    }
+    fNextMerge = 0;
+    fAnalysedEntries = 0;
+    fUnreadEntries = 0;
+
+    if (fOptions.doWaveform) {
+        fSnapshotWriter.reset(new SnapshotWriter(dataIO.GetDir(""), Form("Waveform snapshots - Run %d", fRunNumber)));
+    }
+    if (!fOptions.featureFile.empty()) {
+        fFeatureWriter.reset(new FeatureWriter());
+        if (!fFeatureWriter->Open(fOptions.featureFile)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RunAnalyzer::ProcessChunk(int chunk) {
+    ChunkResult& result = fResults[chunk];
+
+    // Only the workers made by Begin() are used, each with its own 2D waveform histograms, so
+    // calls beyond AnalysisOptions::threads wait for one instead of growing the run's memory
+    Worker* worker = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(fWorkerMutex);
+        fWorkerFree.wait(lock, [this] { return !fIdleWorkers.empty(); });
+        worker = fIdleWorkers.back();
+        fIdleWorkers.pop_back();
+    }
+    ProcessChunk(*worker, result);
+    {
+        std::lock_guard<std::mutex> lock(fWorkerMutex);
+        fIdleWorkers.push_back(worker);
+    }
+    fWorkerFree.notify_one();
+    fAnalysedEntries += result.last - result.first;
+
+    // Whoever completes the next chunk in entry order writes it and the completed ones after it
+    std::lock_guard<std::mutex> lock(fMergeMutex);
+    result.done = true;
+    while (fNextMerge < fResults.size() && fResults[fNextMerge].done) {
+        MergeChunk(*fDataIO, fResults[fNextMerge++]);
+    }
+    return fNextMerge == fResults.size();
+}
+
+bool RunAnalyzer::Finish() {
+    DataIO& dataIO = *fDataIO;
+
+    // Worker order is fixed; the merged 2D histograms and CFD samples do not depend on
+    // which worker processed which chunk
+    for (auto& worker : fWorkers) {
+        MergeWorker(*worker);
+    }
+
+    if (fSnapshotWriter) {
+        std::cout << "Stored " << fSnapshotWriter->GetEntries() << " waveform snapshots" << std::endl;
+        fSnapshotWriter.reset();
+    }
+    if (fFeatureWriter) {
+        fFeatureWriter->Close();
+        fFeatureWriter.reset();
+        std::cout << "Features saved to: " << fOptions.featureFile << std::endl;
+    }
+    if (fUnreadEntries > 0) {
+        std::cerr << "Warning: " << fUnreadEntries << " entries of Run " << fRunNumber << " could not be read and were skipped" << std::endl;
+    }
+    // Only a pass that read every entry knows all signal entries. Otherwise the lists of this
+    // selection are removed, so that no later pass reads only the entries of an incomplete one.
+    if (fSignalIndex) {
+        if (fUnreadEntries > 0) {
+            std::cerr << "Warning: Signal index not saved, the pass did not read every entry" << std::endl;
+            SignalIndex::Remove(fOptions.signalIndexFile, dataIO.GetChannels(), fSelectionKeys);
+        } else if (fSignalIndex->Save(fOptions.signalIndexFile, dataIO.GetChannels(), fSelectionKeys)) {
+            std::cout << "Signal index saved to: " << fOptions.signalIndexFile << std::endl;
+        }
+        fSignalIndex.reset();
+    }
+
+    double realTime = Seconds(fStart);
+    std::cout << "Event loop: " << realTime << " s, "
+              << (realTime > 0 ? fProcessEvents / realTime : 0.) << " events/s" << std::endl;
+    PrintPreselection(fWorkers);
+
+    for (auto& output : fOutputs) {
+        // Converted one at a time, so at most one 2D TH2F is in memory
+        if (output->trig2D) {
+            TH2F* hTrig2D = output->trig2D->MakeHistogram("Waveform_2D_Trig", "Trigger Waveforms 2D;Time [ns];Amplitude [mV]");
+            dataIO.Save(hTrig2D, output->dir);
+            delete hTrig2D;
+            output->trig2D.reset();
+        }
+        if (output->mcp2D) {
+            TH2F* hMCP2D = output->mcp2D->MakeHistogram("Waveform_2D_MCP", "MCP Waveforms 2D;Time [ns];Amplitude [mV]");
+            dataIO.Save(hMCP2D, output->dir);
+            delete hMCP2D;
+            output->mcp2D.reset();
+        }
+
+        output->trigCFDVisualizer.Write(dataIO);
+        output->mcpCFDVisualizer.Write(dataIO);
+
+        if (CONFIG_APPLY_FFT_FILTER && output->spectrum.GetEntries() > 0) {
+            TH1D* hSpectrum = output->spectrum.MakeHistogram("Spectrum_MCP", "MCP Average Power Spectrum;Frequency [Hz];Power [dB]",
+                                                             CONFIG_SAMPLING_RATE);
+            dataIO.Save(hSpectrum, output->dir);
+            delete hSpectrum;
+        }
+
+        WriteAfterpulseSummary(dataIO, *output);
+    }
+
+    fWorkers.clear();
+    fIdleWorkers.clear();
+    fResults.clear();
+    return true;
+}
+
+bool RunAnalyzer::Rehistogram(DataIO& dataIO, const std::vector<int>& channels, const std::string& featureFile) {
+    FeatureReader reader;
+    if (!reader.Open(featureFile)) {
+        return false;
+    }
+
+    // Same histograms and directories as Run(); waveform dumps, 2D waveforms, CFD canvases,
+    // spectra and afterpulse delays need the waveforms and are not rebuilt
+    std::vector<int> outputIndex(16, -1);
+    fOutputs.clear();
+    for (int channel : channels) {
+        outputIndex[channel] = fOutputs.size();
+        fOutputs.emplace_back(new ChannelOutput(channel, channels.size() > 1 ? Form("Ch%d", channel) : "", fRunNumber));
+        CreateHistograms(dataIO, *fOutputs.back());
+    }
+
+    TStopwatch timer;
+    timer.Start();
+
+    // Selection from the configuration (rehist_threshold, rehist_min_tot). Timing, Npe and
+    // afterpulses were only computed for the signal rows of the waveform pass, so a row must
+    // also have been selected there: a looser cut than the pass's cannot add events.
+    std::cout << Form("Rebuilding with amplitude > %g rms and ToT > %g ps", CONFIG_REHIST_THRESHOLD, CONFIG_REHIST_MIN_TOT) << std::endl;
+    long long nEntries = reader.GetEntries();
+    long long nFilled = 0;
+    long long nNotComputed = 0;
+    for (long long entry = 0; entry < nEntries; entry++) {
+        EventFeatures features = reader.GetEntry(entry);
+        if (features.channel < 0 || features.channel >= (int)outputIndex.size()) continue;
+        int index = outputIndex[features.channel];
+        if (index < 0) continue;
+        features.threshold = CONFIG_REHIST_THRESHOLD * features.rms;
+        if (!(features.amp > features.threshold && features.tot > CONFIG_REHIST_MIN_TOT)) continue;
+        if (!features.isSignal) {
+            nNotComputed++;
+            continue;
+        }
+        FillHistograms(*fOutputs[index], features);
+        nFilled++;
+    }
+
+    timer.Stop();
+    std::cout << "Rebuilt histograms from " << nFilled << " selected rows of " << nEntries << " in "
+              << timer.RealTime() << " s" << std::endl;
+    if (nNotComputed > 0) {
+        std::cout << "Warning: " << nNotComputed << " rows pass this selection but not the waveform pass's, "
+                  << "which computed no timing or Npe for them; they are not filled (loosen the cut of the pass instead)" << std::endl;
+    }
+
+    for (auto& output : fOutputs) {
+        WriteAfterpulseSummary(dataIO, *output);
+    }
+    return true;
+}
+
+bool RunAnalyzer::RunPipeline(DataIO& dataIO, std::vector<std::unique_ptr<Worker>>& workers,
+                              const std::vector<std::pair<int, int>>& ranges) {
+    // Same batch boundaries as the chunked loop, hence the same output: kBatchSize analysed
+    // entries per batch, the batches of a range covering it
+    std::vector<std::pair<int, int>> batches;
+    std::vector<int> entries;
+    for (const auto& range : ranges) {
+        ChunkEntries(range.first, range.second, entries);
+        for (size_t i = 0; i < entries.size(); i += kBatchSize) {
+            int first = (i == 0) ? range.first : entries[i];
+            int last = (i + kBatchSize < entries.size()) ? entries[i + kBatchSize] : range.second;
+            batches.emplace_back(first, last);
+        }
+    }
+
+    DataIO readerIO;
+    if (!readerIO.OpenInput(dataIO)) {
+        std::cerr << "Error: Pipeline reader cannot open the input" << std::endl;
+        return false;
+    }
+
+    // Ring of reusable raw batches: the reader stalls when all of them are in flight. A batch
+    // goes back to the ring only once the writer has written its result, so the results waiting
+    // for an earlier batch (the writer's reorder buffer) are bounded by the ring as well.
+    const int nThreads = workers.size();
+    const int nChannels = fOutputs.size();
+    const int ringSize = 2 * nThreads + 2;
+    std::vector<std::unique_ptr<EventBatch>> ring;
+    BoundedQueue<EventBatch*> freeQueue(ringSize);
+    BoundedQueue<EventBatch*> inputQueue(ringSize);
+    BoundedQueue<std::pair<EventBatch*, ChunkResult*>> outputQueue(ringSize);
+    for (int i = 0; i < ringSize; i++) {
+        ring.emplace_back(new EventBatch(nChannels));
+        freeQueue.TryPush(ring.back().get());
+    }
+
+    std::atomic<bool> readerDone(false);
+    StageClock readerClock;
+    std::vector<StageClock> computeClocks(nThreads);
+    StageClock writerClock;
+    Clock::time_point pipelineStart = Clock::now();
+
+    // I/O stage: decompress and decode entries into free batches, in entry order
+    std::thread reader([&] {
+        std::vector<int> readerEntries;
+        for (const auto& range : batches) {
+            EventBatch* batch = nullptr;
+            WaitFor([&] { return freeQueue.TryPop(batch); }, readerClock.waitOutput);
+            
+            Clock::time_point start = Clock::now();
+            batch->first = range.first;
+            batch->last = range.second;
+            batch->nEvents = 0;
+            batch->unread = 0;
+            ChunkEntries(range.first, range.second, readerEntries);
+            for (int evt : readerEntries) {
+                if (!readerIO.GetEvent(evt)) {
+                    batch->unread++;
+                    continue;
+                }
+                WaveformView trigWave = readerIO.GetWaveformView(WaveformType::kTrigger);
+                int slot = batch->nEvents++;
+                batch->events[slot] = evt;
+                batch->trigSize[slot] = std::min<int>(trigWave.size(), kStride);
+                std::copy(trigWave.begin(), trigWave.begin() + batch->trigSize[slot], &batch->trig[slot * kStride]);
+                for (int c = 0; c < nChannels; c++) {
+                    WaveformView mcpWave = readerIO.GetWaveformView(WaveformType::kMcp, c);
+                    int index = c * kBatchSize + slot;
+                    batch->mcpSize[index] = std::min<int>(mcpWave.size(), kStride);
+                    std::copy(mcpWave.begin(), mcpWave.begin() + batch->mcpSize[index], &batch->mcp[index * kStride]);
+                }
+            }
+            readerClock.busy += Seconds(start);
+            
+            WaitFor([&] { return inputQueue.TryPush(batch); }, readerClock.waitOutput);
+        }
+        readerDone.store(true, std::memory_order_release);
+    });
+
+    // Compute stage: correction, filtering and analysis of whole batches
+    auto compute = [&](Worker& worker, StageClock& clock) {
+        for (;;) {
+            EventBatch* batch = nullptr;
+            Clock::time_point waitStart = Clock::now();
+            bool haveBatch = false;
+            for (int spin = 0; !(haveBatch = inputQueue.TryPop(batch)); spin++) {
+                if (readerDone.load(std::memory_order_acquire)) {
+                    haveBatch = inputQueue.TryPop(batch);
+                    break;
+                }
+                Backoff(spin);
+            }
+            clock.waitInput += Seconds(waitStart);
+            if (!haveBatch) break;
+            
+            Clock::time_point start = Clock::now();
+            ChunkResult* result = new ChunkResult();
+            result->first = batch->first;
+            result->last = batch->last;
+            result->unread = batch->unread;
+            for (int slot = 0; slot < batch->nEvents; slot++) {
+                for (int c = 0; c < nChannels; c++) {
+                    int index = c * kBatchSize + slot;
+                    worker.mcpWaves[c] = WaveformView(&batch->mcp[index * kStride], batch->mcpSize[index]);
+                }
+                CorrectEvent(worker, slot, batch->events[slot],
+                             WaveformView(&batch->trig[slot * kStride], batch->trigSize[slot]));
+            }
+            AnalyzeBatch(worker, batch->nEvents, *result);
+            clock.busy += Seconds(start);
+            
+            WaitFor([&] { return outputQueue.TryPush(std::make_pair(batch, result)); }, clock.waitOutput);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 0; i < nThreads; i++) {
+        pool.emplace_back(compute, std::ref(*workers[i]), std::ref(computeClocks[i]));
+    }
+
+    // Output stage (this thread, which owns the output file): write results in entry order and
+    // release their batches. At most ringSize results are pending, one per batch in flight.
+    std::map<int, std::pair<EventBatch*, ChunkResult*>> pending;
+    size_t next = 0;
+    while (next < batches.size()) {
+        std::pair<EventBatch*, ChunkResult*> completed;
+        WaitFor([&] { return outputQueue.TryPop(completed); }, writerClock.waitInput);
+        
+        Clock::time_point start = Clock::now();
+        pending[completed.second->first] = completed;
+        for (auto it = pending.find(batches[next].first); it != pending.end(); it = pending.find(batches[next].first)) {
+            MergeChunk(dataIO, *it->second.second);
+            delete it->second.second;
+            // Never full: the ring holds ringSize batches
+            freeQueue.TryPush(it->second.first);
+            pending.erase(it);
+            if (++next == batches.size()) break;
+        }
+        writerClock.busy += Seconds(start);
+    }
+
+    reader.join();
+    for (auto& thread : pool) thread.join();
+
+    // Utilization: the busiest stage is the bottleneck
+    double wall = Seconds(pipelineStart);
+    StageClock computeClock;
+    for (const StageClock& clock : computeClocks) {
+        computeClock.busy += clock.busy;
+        computeClock.waitInput += clock.waitInput;
+        computeClock.waitOutput += clock.waitOutput;
+    }
+    auto percent = [wall](double t, int n) { return (wall > 0.) ? 100. * t / (wall * n) : 0.; };
+    std::cout << Form("Pipeline utilization over %.2f s:", wall) << std::endl;
+    std::cout << Form("  reader  busy %5.1f%%, blocked by full buffer ring (writer behind) %5.1f%%", 
+                      percent(readerClock.busy, 1), percent(readerClock.waitOutput, 1)) << std::endl;
+    std::cout << Form("  compute busy %5.1f%%, waiting for input %5.1f%%, blocked by writer %5.1f%% (%d threads)", 
+                      percent(computeClock.busy, nThreads), percent(computeClock.waitInput, nThreads), 
+                      percent(computeClock.waitOutput, nThreads), nThreads) << std::endl;
+    std::cout << Form("  writer  busy %5.1f%%, waiting for results %5.1f%%", 
+                      percent(writerClock.busy, 1), percent(writerClock.waitInput, 1)) << std::endl;
+
+    return true;
+}
+
+void RunAnalyzer::ChunkEntries(int first, int last, std::vector<int>& entries) const {
+    entries.clear();
+    if (!fUseIndex) {
+        for (int evt = first; evt < last; evt++) {
+            entries.push_back(evt);
+        }
+        return;
+    }
+    entries.assign(std::lower_bound(fIndexEntries.begin(), fIndexEntries.end(), first),
+                   std::lower_bound(fIndexEntries.begin(), fIndexEntries.end(), last));
+}
+
+void RunAnalyzer::ProcessChunk(Worker& worker, ChunkResult& result) const {
+    const int nChannels = worker.channels.size();
+    std::vector<int>& entries = worker.entries;
+    ChunkEntries(result.first, result.last, entries);
+    for (size_t firstEntry = 0; firstEntry < entries.size(); firstEntry += kBatchSize) {
+        int nBatch = 0;
+        for (size_t i = firstEntry; i < std::min(firstEntry + kBatchSize, entries.size()); i++) {
+            int evt = entries[i];
+            if (!worker.dataIO.GetEvent(evt)) {
+                result.unread++;
+                continue;
+            }
+            for (int c = 0; c < nChannels; c++) {
+                worker.mcpWaves[c] = worker.dataIO.GetWaveformView(WaveformType::kMcp, c);
+            }
+            CorrectEvent(worker, nBatch++, evt, worker.dataIO.GetWaveformView(WaveformType::kTrigger));
+        }
+        AnalyzeBatch(worker, nBatch, result);
+    }
+}
+
+void RunAnalyzer::CorrectEvent(Worker& worker, int slot, int eventNum, WaveformView trigWave) const {
+    const EventAnalyzer& analyzer = worker.analyzer;
+    const WaveformProcessor& processor = worker.processor;
+    const int nChannels = worker.channels.size();
+    worker.trigSize[slot] = std::min<int>(trigWave.size(), kStride);
+    worker.batchEvents[slot] = eventNum;
+
+    // Preselection: the signal selection of AnalyzeBatch on the pedestal region and MCP window
+    // alone (CorrectWindow). It gives the same statistics and decision as the full correction,
+    // so rejected waveforms are not corrected at all, and the trigger only if a channel passes.
+    // The filter changes the RMS and ToT of the whole waveform, so it turns the preselection off.
+    const bool preselect = fOptions.preselect && !analyzer.fApplyFFTFilter;
+    Clock::time_point start;
+    bool anySelected = !preselect;
+    if (preselect) {
+        start = Clock::now();
+        for (int c = 0; c < nChannels; c++) {
+            WorkerChannel& channel = *worker.channels[c];
+            channel.mcpSize[slot] = std::min<int>(worker.mcpWaves[c].size(), kStride);
+            WaveformView mcpWave(worker.mcpWaves[c].data(), channel.mcpSize[slot]);
+            float* corrMCP = &channel.mcpBatch[slot * kStride];
+            WaveformStats stats = processor.CorrectWindow(mcpWave, corrMCP, analyzer.fMcpWindowMin, analyzer.fMcpWindowMax);
+            float threshold = 4.0 * stats.rms;
+            bool selected = (stats.Amplitude() > threshold &&
+                             processor.ToTCut(WaveformView(corrMCP, channel.mcpSize[slot]), analyzer.fMcpWindowMin, analyzer.fMcpWindowMax, stats.rms));
+            channel.mcpStats[slot] = stats;
+            channel.mcpSelected[slot] = selected;
+            anySelected |= selected;
+            worker.preselection.rejectedWaveforms += !selected;
+        }
+        worker.preselection.events++;
+        worker.preselection.rejectedEvents += !anySelected;
+        worker.preselection.mcpWaveforms += nChannels;
+        worker.preselection.preselectSeconds += Seconds(start);
+        if (!anySelected) return;
+        start = Clock::now();
+    }
+
+    // Correct waveforms; baseline RMS and window minimum come from the same pass.
+    // The trigger is shared by all channels and corrected once.
+    processor.Correct(WaveformView(trigWave.data(), worker.trigSize[slot]), &worker.trigBatch[slot * kStride],
+                      analyzer.fTriggerWindowMin, analyzer.fTriggerWindowMax);
+    int corrected = 1;
+    for (int c = 0; c < nChannels; c++) {
+        WorkerChannel& channel = *worker.channels[c];
+        if (preselect && !channel.mcpSelected[slot]) continue;
+        WaveformView mcpWave = worker.mcpWaves[c];
+        channel.mcpSize[slot] = std::min<int>(mcpWave.size(), kStride);
+        channel.mcpStats[slot] = processor.Correct(WaveformView(mcpWave.data(), channel.mcpSize[slot]), &channel.mcpBatch[slot * kStride],
+                                                   analyzer.fMcpWindowMin, analyzer.fMcpWindowMax);
+        channel.mcpSelected[slot] = true;
+        corrected++;
+    }
+    if (preselect) {
+        worker.preselection.correctedWaveforms += corrected;
+        worker.preselection.correctSeconds += Seconds(start);
+    }
+}
+
+void RunAnalyzer::AnalyzeBatch(Worker& worker, int nBatch, ChunkResult& result) const {
+    WaveformProcessor& processor = worker.processor;
+    EventAnalyzer& analyzer = worker.analyzer;
+    const int nChannels = worker.channels.size();
+    const bool keepAll = !fOptions.featureFile.empty();
+    result.dumpCounts.resize(nChannels, 0);
+
+    // Low-pass filter the whole batch of MCP waveforms (first kFFTSize samples) of each channel in place
+    if (analyzer.fApplyFFTFilter) {
+        result.spectra.resize(nChannels);
+        for (int c = 0; c < nChannels; c++) {
+            WorkerChannel& channel = *worker.channels[c];
+            result.spectra[c].emplace_back(WaveformProcessor::kFFTSize);
+            processor.FilterBatch(channel.mcpBatch.data(), channel.mcpBatch.data(), nBatch, kStride,
+                                  analyzer.fFftCutoffFrequency, &result.spectra[c].back());
+        }
+    }
+
+    for (int slot = 0; slot < nBatch; slot++) {
+        int evt = worker.batchEvents[slot];
+        WaveformView corrTrig(&worker.trigBatch[slot * kStride], worker.trigSize[slot]);
+
+        // The trigger CFD time is computed for the first signal channel of the event and reused
+        // by the others; a sampled trigger CFD record is copied rather than recomputed
+        bool haveTriggerTime = false;
+        float triggerTime = 0.;
+        const CFDRecord* triggerRecord = nullptr;
+
+        for (int c = 0; c < nChannels; c++) {
+            WorkerChannel& channel = *worker.channels[c];
+            WaveformView corrMCP(&channel.mcpBatch[slot * kStride], channel.mcpSize[slot]);
+
+            // Signal validation (on the filtered waveform when the filter is applied)
+            float amp = channel.mcpStats[slot].Amplitude();
+            float rms = channel.mcpStats[slot].rms;
+            if (analyzer.fApplyFFTFilter) {
+                amp = analyzer.GetAmp(corrMCP, analyzer.fMcpWindowMin, analyzer.fMcpWindowMax);
+                rms = processor.GetStdDev(corrMCP);
+            }
+            float threshold = 4.0 * rms;
+            // ToT > 800 ps, as ToTCut. The feature tree keeps the ToT of every row, so that
+            // Rehistogram can apply a different selection.
+            bool passAmp = (channel.mcpSelected[slot] && amp > threshold);
+            float tot = (passAmp || keepAll) ? processor.GetToT(corrMCP, analyzer.fMcpWindowMin, analyzer.fMcpWindowMax, rms) : 0.f;
+            bool isSignal = (passAmp && tot > 800.);
+
+            EventRecord record;
+            record.channelIndex = c;
+            EventFeatures& features = record.features;
+            features.eventNum = evt;
+            features.channel = fOutputs[c]->channel;
+            features.isSignal = isSignal;
+            features.pedestal = channel.mcpStats[slot].pedestal;
+            features.rms = rms;
+            features.amp = amp;
+            features.threshold = threshold;
+            features.tot = tot;
+            if (!isSignal) {
+                if (keepAll) result.records.push_back(record);
+                continue;
+            }
+
+            // Waveform analysis. MergeChunk keeps the first maxSnapshots signal events of a channel in
+            // entry order, so a chunk needs at most that many, and none once the merged output of the
+            // channel is full (every chunk not yet merged comes later in entry order).
+            const int quota = fOptions.maxSnapshots;
+            if (fOptions.doWaveform && quota != 0 &&
+                (quota < 0 || (result.dumpCounts[c] < quota && fOutputs[c]->snapshots.load(std::memory_order_relaxed) < quota))) {
+                result.dumpCounts[c]++;
+                int nTrig = std::min<int>(corrTrig.size(), WaveformSnapshot::kSamples);
+                int nMCP = std::min<int>(corrMCP.size(), WaveformSnapshot::kSamples);
+                result.dumps.push_back({evt, c, std::vector<float>(corrTrig.begin(), corrTrig.begin() + nTrig),
+                                        std::vector<float>(corrMCP.begin(), corrMCP.begin() + nMCP)});
+            }
+
+            // 2D waveform analysis
+            if (fOptions.doWaveform2D) {
+                channel.trig2D->Fill(corrTrig.data(), corrTrig.size());
+                channel.mcp2D->Fill(corrMCP.data(), corrMCP.size());
+            }
+
+            // Timing analysis
+            if (fOptions.doTiming) {
+                CFDRecord* trigRecord = channel.trigCFDVisualizer.Next(evt);
+                if (!haveTriggerTime || (trigRecord && !triggerRecord)) {
+                    triggerTime = analyzer.GetCFDTime(corrTrig, 0, evt, analyzer.fTriggerWindowMin, analyzer.fTriggerWindowMax,
+                                                      analyzer.fTriggerCfdFraction, analyzer.fTriggerCfdDelay, true, trigRecord);
+                    haveTriggerTime = true;
+                    if (trigRecord) triggerRecord = trigRecord;
+                } else if (trigRecord) {
+                    *trigRecord = *triggerRecord;
+                }
+                features.triggerTime = triggerTime;
+                features.mcpTime = analyzer.GetCFDTime(corrMCP, features.channel, evt, analyzer.fMcpWindowMin, analyzer.fMcpWindowMax,
+                                                       analyzer.fMcpCfdFraction, analyzer.fMcpCfdDelay, false,
+                                                       channel.mcpCFDVisualizer.Next(evt));
+                // Only records with a crossing enter the samples
+                channel.trigCFDVisualizer.Keep();
+                channel.mcpCFDVisualizer.Keep();
+            }
+
+            // Npe analysis
+            if (fOptions.doNpe) {
+                features.npe = analyzer.GetNpe(corrMCP, analyzer.fMcpWindowMin, analyzer.fMcpWindowMax);
+            }
+
+            // Afterpulse analysis: pulses after the signal, timed from the signal minimum
+            if (fOptions.doAfterpulse) {
+                features.nAfterpulses = worker.afterpulseFinder.Find(corrMCP, threshold, worker.pulses);
+                int signalPeak = channel.mcpStats[slot].minIndex >= 0 ? channel.mcpStats[slot].minIndex : analyzer.fMcpWindowMin;
+                for (const Pulse& pulse : worker.pulses) {
+                    result.afterpulseDelays.emplace_back(c, (pulse.peakIndex - signalPeak) * processor.fDeltaT * 1e-3);
+                }
+            }
+
+            result.records.push_back(record);
+        }
+    }
+}
+
+void RunAnalyzer::PrintPreselection(const std::vector<std::unique_ptr<Worker>>& workers) const {
+    PreselectionStats total;
+    for (const auto& worker : workers) {
+        total.Add(worker->preselection);
+    }
+    if (total.events == 0) return;
+
+    // Time saved: the skipped corrections at the measured cost of a full correction, less the
+    // preselection itself (thread time, so it adds up over threads)
+    long long skipped = total.rejectedWaveforms + total.rejectedEvents;
+    double perWaveform = (total.correctedWaveforms > 0) ? total.correctSeconds / total.correctedWaveforms : 0.;
+    std::cout << Form("Preselection: %lld/%lld events (%.1f%%) and %lld/%lld MCP waveforms (%.1f%%) rejected before correction",
+                      total.rejectedEvents, total.events, 100. * total.rejectedEvents / total.events,
+                      total.rejectedWaveforms, total.mcpWaveforms, 100. * total.rejectedWaveforms / total.mcpWaveforms) << std::endl;
+    std::cout << Form("  about %.2f s of correction saved (%lld waveforms at %.2f us), preselection took %.2f s",
+                      skipped * perWaveform - total.preselectSeconds, skipped, perWaveform * 1e6, total.preselectSeconds) << std::endl;
+}
+
+void RunAnalyzer::MergeChunk(DataIO& dataIO, ChunkResult& result) {
+    fUnreadEntries += result.unread;
+    for (int evt = (result.first + 999) / 1000 * 1000; evt < result.last && fOptions.printProgress; evt += 1000) {
+        std::cout << "Processing event " << evt << "/" << fProcessEvents << "..." << std::endl;
+    }
+
+    // The first maxSnapshots signal events of each channel, in entry order
+    for (const WaveformDump& dump : result.dumps) {
+        ChannelOutput& output = *fOutputs[dump.channelIndex];
+        if (fOptions.maxSnapshots >= 0 && output.snapshots >= fOptions.maxSnapshots) continue;
+        fSnapshotWriter->Fill(dump.eventNum, output.channel, dump.trig.data(), dump.trig.size(),
+                              dump.mcp.data(), dump.mcp.size());
+        output.snapshots++;
+    }
+
+    // Fills and feature rows in entry order, exactly as a serial loop makes them
+    for (const EventRecord& record : result.records) {
+        if (fFeatureWriter) {
+            fFeatureWriter->Fill(record.features);
+        }
+        if (fSignalIndex && record.features.isSignal) {
+            fSignalIndex->Add(record.channelIndex, record.features.eventNum);
+        }
+        if (record.features.isSignal) {
+            FillHistograms(*fOutputs[record.channelIndex], record.features);
+        }
+    }
+
+    for (const auto& delay : result.afterpulseDelays) {
+        fOutputs[delay.first]->hAfterpulseDelay->Fill(delay.second);
+    }
+
+    // Batch by batch, so the sum does not depend on how batches were grouped into chunks
+    for (size_t c = 0; c < result.spectra.size(); c++) {
+        for (const PowerSpectrum& batchSpectrum : result.spectra[c]) {
+            fOutputs[c]->spectrum.Add(batchSpectrum);
+        }
+    }
+
+    // Release the chunk's memory as soon as it is written
+    result.records = std::vector<EventRecord>();
+    result.dumps = std::vector<WaveformDump>();
+    result.dumpCounts = std::vector<int>();
+    result.spectra = std::vector<std::vector<PowerSpectrum>>();
+    result.afterpulseDelays = std::vector<std::pair<int, float>>();
+}
+
+void RunAnalyzer::FillHistograms(ChannelOutput& output, const EventFeatures& features) {
+    if (output.hToT) {
+        output.hToT->Fill(features.amp, features.tot);
+    }
+    if (output.hTrigTiming) {
+        output.hTrigTiming->Fill(features.triggerTime);
+        output.hMCPTiming->Fill(features.mcpTime);
+        output.hDiffTiming->Fill(features.mcpTime - features.triggerTime);
+    }
+    if (output.hAmp) {
+        output.hAmp->Fill(features.amp);
+    }
+    if (output.hNpe && features.npe > features.threshold) {
+        output.hNpe->Fill(features.npe);
+    }
+    if (output.hAfterpulseCount) {
+        output.hAfterpulseCount->Fill(features.nAfterpulses);
+        output.afterpulseEvents += (features.nAfterpulses > 0);
+        output.afterpulses += features.nAfterpulses;
+    }
+}
+
+void RunAnalyzer::MergeWorker(Worker& worker) {
+    for (size_t c = 0; c < fOutputs.size(); c++) {
+        ChannelOutput& output = *fOutputs[c];
+        WorkerChannel& channel = *worker.channels[c];
+        output.trigCFDVisualizer.Merge(channel.trigCFDVisualizer);
+        output.mcpCFDVisualizer.Merge(channel.mcpCFDVisualizer);
+
+        // Integer counts add up exactly in any order; the first worker's accumulators are taken
+        // over rather than copied. The statistics are computed from the bins when written.
+        for (auto hist : {std::make_pair(&output.trig2D, &channel.trig2D), std::make_pair(&output.mcp2D, &channel.mcp2D)}) {
+            if (!*hist.second) continue;
+            if (!*hist.first) {
+                *hist.first = std::move(*hist.second);
+            } else {
+                (*hist.first)->Add(**hist.second);
+                hist.second->reset();
+            }
+        }
+    }
+}
+
+} // namespace HRPPD
@@ -0,0 +1,111 @@
+#include "../include/SignalIndex.h"
+
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include "TFile.h"
+#include "TEntryList.h"
+#include "TDirectory.h"
+#include "TString.h"
+#include "TSystem.h"
+#include "TMD5.h"
+
+
+namespace HRPPD {
+
+void SignalIndex::Reset(int nChannels) {
+    fEntries.assign(nChannels, std::vector<int>());
+}
+
+std::string SignalIndex::ListName(int channel, const std::string& key) {
+    TMD5 md5;
+    md5.Update(reinterpret_cast<const UChar_t*>(key.data()), key.size());
+    md5.Final();
+    // 64 bits of the digest are plenty to tell selections apart
+    return Form("Signal_ch%d_%.16s", channel, md5.AsString());
+}
+
+bool SignalIndex::Load(const std::string& fileName, const std::vector<int>& channels, const std::vector<std::string>& keys) {
+    Reset(channels.size());
+    // AccessPathName is true when the file does not exist
+    if (gSystem->AccessPathName(fileName.c_str())) {
+        return false;
+    }
+
+    TDirectory::TContext context;
+    std::unique_ptr<TFile> file(TFile::Open(fileName.c_str(), "READ"));
+    if (!file || file->IsZombie()) {
+        std::cerr << "Warning: Cannot read signal index - " << fileName << std::endl;
+        return false;
+    }
+
+    for (size_t c = 0; c < channels.size(); c++) {
+        TEntryList* list = file->Get<TEntryList>(ListName(channels[c], keys[c]).c_str());
+        if (!list) {
+            Reset(channels.size());
+            return false;
+        }
+        std::vector<int>& entries = fEntries[c];
+        entries.reserve(list->GetN());
+        for (Long64_t i = 0; i < list->GetN(); i++) {
+            entries.push_back(list->GetEntry(i));
+        }
+        delete list;
+    }
+    return true;
+}
+
+bool SignalIndex::Save(const std::string& fileName, const std::vector<int>& channels, const std::vector<std::string>& keys) const {
+    TDirectory::TContext context;
+    std::unique_ptr<TFile> file(TFile::Open(fileName.c_str(), "UPDATE"));
+    if (!file || file->IsZombie()) {
+        std::cerr << "Error: Failed to write signal index - " << fileName << std::endl;
+        return false;
+    }
+
+    for (size_t c = 0; c < channels.size(); c++) {
+        std::string name = ListName(channels[c], keys[c]);
+        TEntryList list(name.c_str(), keys[c].c_str());
+        list.SetDirectory(nullptr);
+        list.SetTreeName("MCPTree");
+        for (int entry : fEntries[c]) {
+            list.Enter(entry);
+        }
+        file->WriteTObject(&list, name.c_str(), "WriteDelete");
+    }
+    file->Close();
+    return true;
+}
+
+bool SignalIndex::Remove(const std::string& fileName, const std::vector<int>& channels, const std::vector<std::string>& keys) {
+    if (gSystem->AccessPathName(fileName.c_str())) {
+        return true;
+    }
+
+    TDirectory::TContext context;
+    std::unique_ptr<TFile> file(TFile::Open(fileName.c_str(), "UPDATE"));
+    if (!file || file->IsZombie()) {
+        std::cerr << "Error: Failed to update signal index - " << fileName << std::endl;
+        return false;
+    }
+
+    for (size_t c = 0; c < channels.size(); c++) {
+        file->Delete((ListName(channels[c], keys[c]) + ";*").c_str());
+    }
+    file->Close();
+    return true;
+}
+
+std::vector<int> SignalIndex::GetUnion() const {
+    std::vector<int> entries;
+    for (const std::vector<int>& channelEntries : fEntries) {
+        std::vector<int> merged;
+        merged.reserve(entries.size() + channelEntries.size());
+        std::set_union(entries.begin(), entries.end(), channelEntries.begin(), channelEntries.end(), std::back_inserter(merged));
+        entries.swap(merged);
+    }
+    return entries;
+}
+
+} // namespace HRPPD
@@ -1,5 +1,7 @@
 #include "../include/WaveformProcessor.h"
 #include "../include/Config.h"
+#include "../include/FFTFilterEngine.h"
+#include "../include/CpuDispatch.h"
 
 #include <TH1F.h>
 #include <TDirectory.h>
@@ -20,6 +22,7 @@
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <cfloat>
 
 
 namespace HRPPD {
@@ -28,12 +31,13 @@ WaveformProcessor::WaveformProcessor() {
     fCalibrationConstant = CONFIG_CALIBRATION_CONSTANT;
     fDeltaT = CONFIG_DELTA_T;
     fSamplingRate = CONFIG_SAMPLING_RATE;
+    fFilterMode = CONFIG_FILTER_MODE;
 }
 
 WaveformProcessor::~WaveformProcessor() {
 }
 
-std::vector<float> WaveformProcessor::Correct(const std::vector<float>& waveform) {
+std::vector<float> WaveformProcessor::Correct(WaveformView waveform) const {
     float ped = std::accumulate(waveform.begin(), waveform.begin() + 128, 0.) / 128;
     std::vector<float> corrWave;
     
@@ -44,7 +48,129 @@ std::vector<float> WaveformProcessor::Correct(const std::vector<float>& waveform
     return corrWave;
 }
 
-float WaveformProcessor::GetStdDev(const std::vector<float>& waveform) {
+#if defined(HRPPD_AVX2_KERNELS)
+// 8 samples per step; (x - ped) * cal is rounded the same way as the scalar loop.
+// Samples outside the window are replaced by FLT_MAX before taking the running minimum.
+// Returns the number of samples done; the caller finishes the tail.
+HRPPD_AVX2_TARGET
+static int CorrectAVX2(const float* input, float* output, int nSamples, float ped, float cal,
+                       int windowMin, int windowMax, float& winMin) {
+    const __m256 vPed = _mm256_set1_ps(ped);
+    const __m256 vCal = _mm256_set1_ps(cal);
+    const __m256 vMax = _mm256_set1_ps(FLT_MAX);
+    const __m256i vLow = _mm256_set1_epi32(windowMin - 1);
+    const __m256i vHigh = _mm256_set1_epi32(windowMax);
+    const __m256i vStep = _mm256_set1_epi32(8);
+    __m256i vIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 vMin = vMax;
+
+    int i = 0;
+    for (; i + 8 <= nSamples; i += 8) {
+        __m256 corr = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(input + i), vPed), vCal);
+        _mm256_storeu_ps(output + i, corr);
+
+        __m256i inWindow = _mm256_and_si256(_mm256_cmpgt_epi32(vIndex, vLow), _mm256_cmpgt_epi32(vHigh, vIndex));
+        vMin = _mm256_min_ps(vMin, _mm256_blendv_ps(vMax, corr, _mm256_castsi256_ps(inWindow)));
+        vIndex = _mm256_add_epi32(vIndex, vStep);
+    }
+
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, vMin);
+    for (int lane = 0; lane < 8; lane++) {
+        winMin = std::min(winMin, lanes[lane]);
+    }
+    return i;
+}
+#endif
+
+WaveformStats WaveformProcessor::Correct(WaveformView waveform, float* output, int windowMin, int windowMax) const {
+    WaveformStats stats;
+    const int nSamples = waveform.size();
+    const float* input = waveform.data();
+    const float cal = fCalibrationConstant;
+
+    // Pedestal summed in double, exactly as the vector version
+    float ped = std::accumulate(input, input + 128, 0.) / 128;
+    stats.pedestal = ped;
+
+    windowMin = std::max(windowMin, 0);
+    windowMax = std::min(windowMax, nSamples);
+    float winMin = FLT_MAX;
+    int i = 0;
+
+#if defined(HRPPD_AVX2_KERNELS)
+    if (CpuHasAVX2()) {
+        i = CorrectAVX2(input, output, nSamples, ped, cal, windowMin, windowMax, winMin);
+    }
+#endif
+
+    // Scalar path (tail, or the whole waveform without AVX2)
+    for (; i < nSamples; i++) {
+        output[i] = (input[i] - ped) * cal;
+        if (i >= windowMin && i < windowMax) {
+            winMin = std::min(winMin, output[i]);
+        }
+    }
+
+    // First occurrence of the minimum, as std::min_element
+    for (int j = windowMin; j < windowMax; j++) {
+        if (output[j] == winMin) {
+            stats.min = winMin;
+            stats.minIndex = j;
+            break;
+        }
+    }
+
+    stats.rms = BaselineRMS(output);
+
+    return stats;
+}
+
+WaveformStats WaveformProcessor::CorrectWindow(WaveformView waveform, float* output, int windowMin, int windowMax) const {
+    WaveformStats stats;
+    const int nSamples = waveform.size();
+    const float* input = waveform.data();
+    const float cal = fCalibrationConstant;
+
+    float ped = std::accumulate(input, input + 128, 0.) / 128;
+    stats.pedestal = ped;
+
+    // (x - ped) * cal rounds the same in any order, so these samples equal Correct's
+    for (int i = 0; i < std::min(128, nSamples); i++) {
+        output[i] = (input[i] - ped) * cal;
+    }
+
+    windowMin = std::max(windowMin, 0);
+    windowMax = std::min(windowMax, nSamples);
+    float winMin = FLT_MAX;
+    for (int i = windowMin; i < windowMax; i++) {
+        output[i] = (input[i] - ped) * cal;
+        if (output[i] < winMin) {
+            winMin = output[i];
+            stats.minIndex = i;
+        }
+    }
+    if (stats.minIndex >= 0) {
+        stats.min = winMin;
+    }
+
+    stats.rms = BaselineRMS(output);
+
+    return stats;
+}
+
+float WaveformProcessor::BaselineRMS(const float* corrected) {
+    // Same arithmetic as GetStdDev
+    float mean = std::accumulate(corrected, corrected + 128, 0.) / 128;
+    float sumSquaredDiff = 0.;
+    for (int j = 0; j < 128; j++) {
+        float diff = corrected[j] - mean;
+        sumSquaredDiff += diff * diff;
+    }
+    return std::sqrt(sumSquaredDiff / 128);
+}
+
+float WaveformProcessor::GetStdDev(WaveformView waveform) const {
   float mean = std::accumulate(waveform.begin(), waveform.begin() + 128, 0.) / 128;
   
   float sumSquaredDiff = 0.;
@@ -57,7 +183,7 @@ float WaveformProcessor::GetStdDev(const std::vector<float>& waveform) {
   return ped;
 }
 
-float WaveformProcessor::GetOverShoot(const std::vector<float>& waveform, int fitWindowMin, int fitWindowMax) {
+float WaveformProcessor::GetOverShoot(WaveformView waveform, int fitWindowMin, int fitWindowMax) const {
     float amp = *std::min_element(waveform.begin() + fitWindowMin, waveform.begin() + fitWindowMax);
     auto ampIter = std::min_element(waveform.begin() + fitWindowMin, waveform.begin() + fitWindowMax);
     int ampIdx = std::distance(waveform.begin(), ampIter);
@@ -67,9 +193,9 @@ float WaveformProcessor::GetOverShoot(const std::vector<float>& waveform, int fi
     return overshoot;
 }
 
-int WaveformProcessor::GetToTBin(const std::vector<float>& waveform, int fitWindowMin, int fitWindowMax) {
+int WaveformProcessor::GetToTBin(WaveformView waveform, int fitWindowMin, int fitWindowMax, float stdDev) const {
     int totBin = 0;
-    float threshold = -4. * GetStdDev(waveform);
+    float threshold = -4. * (stdDev < 0. ? GetStdDev(waveform) : stdDev);
 
     for (int i = fitWindowMin; i < fitWindowMax; i++) {
         if (waveform.at(i) < threshold) {
@@ -97,107 +223,82 @@ int WaveformProcessor::GetToTBin(const std::vector<float>& waveform, int fitWind
 //     return consecutive;
 // }
 
-float WaveformProcessor::GetToT(const std::vector<float>& waveform, int fitWindowMin, int fitWindowMax) {
-    int totBin = GetToTBin(waveform, fitWindowMin, fitWindowMax);
+float WaveformProcessor::GetToT(WaveformView waveform, int fitWindowMin, int fitWindowMax, float stdDev) const {
+    int totBin = GetToTBin(waveform, fitWindowMin, fitWindowMax, stdDev);
     float tot = totBin * fDeltaT;
     
     return tot;
 }
 
-bool WaveformProcessor::ToTCut(const std::vector<float>& waveform, int fitWindowMin, int fitWindowMax) {
-    return GetToT(waveform, fitWindowMin, fitWindowMax) > 800.;
+bool WaveformProcessor::ToTCut(WaveformView waveform, int fitWindowMin, int fitWindowMax, float stdDev) const {
+    return GetToT(waveform, fitWindowMin, fitWindowMax, stdDev) > 800.;
 }
 
-float WaveformProcessor::LowPassFilter(float cutoffFrequency, int order, float inputFreq) {
+float WaveformProcessor::LowPassFilter(float cutoffFrequency, int order, float inputFreq) const {
     double f = 1.0/(1+TMath::Power(inputFreq/cutoffFrequency, 2*order));
     return f;
 }
 
-std::vector<float> WaveformProcessor::FFTFilter(const std::vector<float>& waveform, float cutoffFrequency,
-                                           int eventNum, int channel) {
-    int dimSize = 1000;
-    double f;
+FFTFilterEngine* WaveformProcessor::GetFFTEngine(float cutoffFrequency) {
+    if (!fFFTEngine) {
+        fFFTEngine.reset(new FFTFilterEngine(kFFTSize));
+    }
     
-    TH1F* waveOriginal = new TH1F("wave_original", "wave_original", dimSize, 0, 200.);
-    for (int i = 0; i < dimSize && i < waveform.size(); i++) {
-        waveOriginal->SetBinContent(i+1, waveform.at(i));
+    if (cutoffFrequency != fFFTCutoffFrequency || fSamplingRate != fFFTSamplingRate) {
+        // Order-8 Butterworth weight of each frequency bin up to Nyquist
+        std::vector<double> transfer(fFFTEngine->GetNFrequencies());
+        for (int i = 0; i < (int)transfer.size(); i++) {
+            transfer[i] = LowPassFilter(cutoffFrequency, 8, i * fSamplingRate / kFFTSize);
+        }
+        fFFTEngine->SetTransfer(transfer);
+        fFFTCutoffFrequency = cutoffFrequency;
+        fFFTSamplingRate = fSamplingRate;
     }
+    
+    return fFFTEngine.get();
+}
 
-    TString uniqueName = Form("evt%d_ch%d", eventNum, channel);
+bool WaveformProcessor::FFTFilter(const float* input, float* output, float cutoffFrequency, PowerSpectrum* spectrum) {
+    return GetFFTEngine(cutoffFrequency)->Filter(input, output, spectrum);
+}
 
-    // FFT real part
-    TH1 *hr = 0;
-    hr = waveOriginal->FFT(hr, "RE");
-    hr->SetName(Form("hr_%s", uniqueName.Data()));
-    
-    // FFT imaginary part
-    TH1 *him = 0;
-    him = waveOriginal->FFT(him, "IM");
-    him->SetName(Form("him_%s", uniqueName.Data()));
-
-    // FFT magnitude
-    TH1D *hmag = 0;
-    hmag = (TH1D*)waveOriginal->FFT(hmag, "MAG");
-    hmag->SetName(Form("hmag_%s", uniqueName.Data()));
-    hmag->SetTitle("Magnitude of the 1st transform");
-    hmag->GetXaxis()->Set(dimSize, 0, fSamplingRate);
-    hmag->Scale(1./sqrt(dimSize)); //scale to 1/SQRT(n)
-
-    TVirtualFFT *fftSignal = TVirtualFFT::GetCurrentTransform();
-        
-    //Frequency filtering
-    std::vector<float> reFft;
-    std::vector<float> imFft;
-    std::vector<float> magFft;
-
-    double *reFull = new double[dimSize];
-    double *imFull = new double[dimSize];
-    fftSignal->GetPointsComplex(reFull, imFull);
-
-    for (int i = 0; i < dimSize; i++) {
-        f = LowPassFilter(cutoffFrequency, 8, i * fSamplingRate / dimSize);
-
-        if (i < (dimSize / 2)) {
-            reFft.push_back(reFull[i]);
-            imFft.push_back(imFull[i]);
-            magFft.push_back(20 * log10(hmag->GetBinContent(i+1))); // Note: the power has already been scaled by sqrt(n). Y axis is translated to 20*log(mag_fft) dB
-        }          
-
-        // Spectrum filtering
-        std::vector<float> magProcessed;
-
-        reFull[i] = (reFull[i])*f;
-        imFull[i] = (imFull[i])*f;
-        if (i < (dimSize / 2)) {
-            magProcessed.push_back(20*log10(sqrt(reFull[i]*reFull[i]+imFull[i]*imFull[i]) / sqrt(dimSize)));
-        }
+const IIRFilter& WaveformProcessor::GetIIRFilter(float cutoffFrequency) {
+    if (cutoffFrequency != fIIRCutoffFrequency || fSamplingRate != fIIRSamplingRate) {
+        fIIRFilter.SetLowPass(cutoffFrequency, fSamplingRate);
+        fIIRCutoffFrequency = cutoffFrequency;
+        fIIRSamplingRate = fSamplingRate;
     }
-        
-    // Now let's make a backward transform:
-    TVirtualFFT *fftBack = TVirtualFFT::FFT(1, &dimSize, "C2R M K");
-    fftBack->SetPointsComplex(reFull,imFull);
-    fftBack->Transform();
-    TH1 *hb = 0;
+    
+    return fIIRFilter;
+}
 
-    hb = TH1::TransformHisto(fftBack,hb,"Re");
-    hb->SetTitle("The backward transform result");
-    hb->Scale(1.0/dimSize);
-    hb->GetXaxis()->Set(dimSize, 0, dimSize * fDeltaT); //ps
+bool WaveformProcessor::FilterWaveform(const float* input, float* output, float cutoffFrequency) {
+    if (fFilterMode == "iir") {
+        const IIRFilter& filter = GetIIRFilter(cutoffFrequency);
+        filter.Filter(input, output, kFFTSize);
+        return filter.IsValid();
+    }
+    return FFTFilter(input, output, cutoffFrequency);
+}
 
-    std::vector<float> waveVecFiltered;
-    for(int i = 0; i < dimSize; i++) {
-        waveVecFiltered.push_back(hb->GetBinContent(i+1));
+bool WaveformProcessor::FilterBatch(const float* input, float* output, int nEvents, int stride, 
+                                    float cutoffFrequency, PowerSpectrum* spectrum) {
+    if (fFilterMode == "iir") {
+        const IIRFilter& filter = GetIIRFilter(cutoffFrequency);
+        return filter.FilterBatch(input, output, nEvents, stride, kFFTSize);
     }
 
-    delete[] reFull;
-    delete[] imFull;
-    delete hb;
-    delete hr;
-    delete him;
-    delete hmag;
-    delete waveOriginal;
-    fftBack = 0;
+    return GetFFTEngine(cutoffFrequency)->FilterBatch(input, output, nEvents, stride, spectrum);
+}
 
+std::vector<float> WaveformProcessor::FFTFilter(WaveformView waveform, float cutoffFrequency,
+                                           int eventNum, int channel) {
+    // Short waveforms are zero-padded to kFFTSize
+    std::vector<float> waveVecFiltered(kFFTSize, 0.);
+    std::copy(waveform.begin(), waveform.begin() + std::min<size_t>(waveform.size(), kFFTSize), waveVecFiltered.begin());
+    
+    FFTFilter(waveVecFiltered.data(), waveVecFiltered.data(), cutoffFrequency);
+    
     return waveVecFiltered;
 }
 